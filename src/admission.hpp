@@ -0,0 +1,175 @@
+// metricq-db-hta
+// Copyright (C) 2021 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-db-hta.
+//
+// metricq-db-hta is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-db-hta is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-db-hta.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include "db_stats.hpp"
+#include "write_queue.hpp"
+
+#include <metricq/json.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+struct AdmissionConfig
+{
+    AdmissionConfig() = default;
+
+    AdmissionConfig(const metricq::json& config)
+    {
+        if (!config.count("admission"))
+        {
+            return;
+        }
+        const auto& admission = config.at("admission");
+        auto bytes = admission.value("pending_bytes", std::int64_t(0));
+        auto chunks = admission.value("metric_chunks", std::int64_t(0));
+        if (bytes < 0 || chunks < 0)
+        {
+            throw std::runtime_error(
+                "configuration error, invalid admission pending_bytes or metric_chunks");
+        }
+        pending_bytes = bytes;
+        metric_chunks = chunks;
+    }
+
+    // completions of writes are held back while more bytes are pending, 0 means unlimited
+    std::size_t pending_bytes = 0;
+    // completions of writes to a metric are held back while more chunks of the metric are
+    // pending, 0 means unlimited
+    std::size_t metric_chunks = 0;
+};
+
+/**
+ * Limits the memory used by received but not yet written chunks.
+ *
+ * Chunks can't be rejected, so instead the completions of finished writes are held back while
+ * too much data is pending. The data of unacknowledged messages counts towards the prefetch
+ * limit of the broker, which thus stops delivering until the backlog has been written.
+ * Held completions are released as soon as the pending data is below the limit again.
+ */
+class AdmissionControl
+{
+public:
+    explicit AdmissionControl(DbStats& stats) : stats_(stats)
+    {
+    }
+
+    void configure(const AdmissionConfig& config)
+    {
+        std::vector<WriteCompletion> released;
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            pending_bytes_limit_ = config.pending_bytes;
+            metric_chunks_limit_ = config.metric_chunks;
+            if (!over_limit_())
+            {
+                released.swap(held_);
+            }
+        }
+        complete_all_(released);
+    }
+
+    /**
+     * Account a received chunk until it has been written
+     */
+    void admit(std::size_t bytes)
+    {
+        auto pending = pending_bytes_.fetch_add(bytes) + bytes;
+        stats_.write_pending_bytes(pending);
+    }
+
+    /**
+     * Must be called once chunks have been written, before their completions
+     */
+    void written(std::size_t bytes)
+    {
+        auto pending = pending_bytes_.fetch_sub(bytes) - bytes;
+        stats_.write_pending_bytes(pending);
+        std::vector<WriteCompletion> released;
+        {
+            // must be checked under the lock after the update, otherwise a completion that is
+            // held concurrently could miss its release
+            std::lock_guard<std::mutex> guard(lock_);
+            if (held_.empty() || over_limit_())
+            {
+                return;
+            }
+            released.swap(held_);
+        }
+        complete_all_(released);
+    }
+
+    /**
+     * @return true if a metric with the given number of pending chunks must hold back its
+     *         completions
+     */
+    bool metric_over_limit(std::size_t pending_chunks) const
+    {
+        auto limit = metric_chunks_limit_.load();
+        return limit > 0 && pending_chunks > limit;
+    }
+
+    /**
+     * Complete a write right away, or hold the completion while too many bytes are pending
+     */
+    void complete(WriteCompletion completion)
+    {
+        // only a held completion must be synchronized with its release
+        if (over_limit_())
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            if (over_limit_())
+            {
+                held_.emplace_back(std::move(completion));
+                stats_.write_throttled();
+                return;
+            }
+        }
+        completion();
+    }
+
+private:
+    bool over_limit_() const
+    {
+        auto limit = pending_bytes_limit_.load();
+        return limit > 0 && pending_bytes_.load() > limit;
+    }
+
+    static void complete_all_(std::vector<WriteCompletion>& completions)
+    {
+        for (auto& completion : completions)
+        {
+            completion();
+        }
+    }
+
+    DbStats& stats_;
+    std::atomic<std::size_t> pending_bytes_limit_{ 0 };
+    std::atomic<std::size_t> metric_chunks_limit_{ 0 };
+    std::atomic<std::size_t> pending_bytes_{ 0 };
+    // protects held_ and changes of the limits
+    std::mutex lock_;
+    std::vector<WriteCompletion> held_;
+};
@@ -29,11 +29,23 @@
 // SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #pragma once
 
+#include "admission.hpp"
+#include "chunk_buffer.hpp"
+#include "chunk_filter.hpp"
 #include "db_stats.hpp"
 #include "log.hpp"
+#include "metric_handle.hpp"
+#include "published.hpp"
+#include "read_flights.hpp"
+#include "response_arena.hpp"
+#include "response_cache.hpp"
+#include "scheduler.hpp"
+#include "worker_pool.hpp"
+#include "write_queue.hpp"
 
 #include <hta/directory.hpp>
 #include <hta/hta.hpp>
+#include <hta/ostream.hpp>
 
 #include <metricq/chrono.hpp>
 #include <metricq/datachunk.pb.h>
@@ -42,13 +54,15 @@
 
 #include <asio.hpp>
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
-#include <map>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <thread>
 #include <unordered_map>
-#include <unordered_set>
+#include <variant>
 #include <vector>
 
 #include <cassert>
@@ -99,56 +113,420 @@ struct LoggingConfig
     bool non_monotonic_values = true;
 };
 
+struct FlushConfig
+{
+    enum class Policy
+    {
+        // flush after every write pass
+        chunk,
+        // flush once a number of values has been inserted since the last flush
+        values,
+        // flush once a time interval has passed since the last flush
+        interval,
+        // flush when there are no more chunks queued for the metric
+        idle,
+    };
+
+    FlushConfig() = default;
+
+    FlushConfig(const metricq::json& config)
+    {
+        if (!config.count("flush"))
+        {
+            return;
+        }
+        const auto& flush = config.at("flush");
+        auto policy_name = flush.value("policy", std::string("chunk"));
+        if (policy_name == "chunk")
+        {
+            policy = Policy::chunk;
+        }
+        else if (policy_name == "values")
+        {
+            policy = Policy::values;
+        }
+        else if (policy_name == "interval")
+        {
+            policy = Policy::interval;
+        }
+        else if (policy_name == "idle")
+        {
+            policy = Policy::idle;
+        }
+        else
+        {
+            throw std::runtime_error("configuration error, unknown flush policy: " + policy_name);
+        }
+        values = flush.value("values", values);
+        interval = std::chrono::milliseconds(flush.value("interval", interval.count()));
+        if (values == 0 || interval.count() <= 0)
+        {
+            throw std::runtime_error("configuration error, invalid flush values or interval");
+        }
+    }
+
+    Policy policy = Policy::chunk;
+    std::uint64_t values = 10000;
+    // for all policies other than chunk, dirty metrics are flushed in the background at least
+    // after this interval, bounding the window of acknowledged but not yet durable data
+    std::chrono::milliseconds interval = std::chrono::milliseconds(1000);
+};
+
+struct SlicingConfig
+{
+    SlicingConfig() = default;
+
+    SlicingConfig(const metricq::json& config, int reader_threads) : max_slices(reader_threads)
+    {
+        if (!config.count("slicing"))
+        {
+            return;
+        }
+        const auto& slicing = config.at("slicing");
+        rows = slicing.value("rows", rows);
+        max_slices = slicing.value("max_slices", max_slices);
+        if (rows < 0 || max_slices < 1)
+        {
+            throw std::runtime_error("configuration error, invalid slicing rows or max_slices");
+        }
+    }
+
+    // timeline requests are split into slices of at least this many estimated rows,
+    // 0 disables slicing
+    std::int64_t rows = 0;
+    int max_slices = 1;
+};
+
+struct ResponseLimitConfig
+{
+    ResponseLimitConfig() = default;
+
+    ResponseLimitConfig(const metricq::json& config)
+    {
+        max_rows = config.value("max_response_rows", max_rows);
+        auto action = config.value("oversized_response", std::string("promote"));
+        if (max_rows < 0 || (action != "promote" && action != "reject"))
+        {
+            throw std::runtime_error(
+                "configuration error, invalid max_response_rows or oversized_response");
+        }
+        promote = action == "promote";
+    }
+
+    // timeline requests estimated to produce more rows are promoted to a coarser aggregate
+    // level or rejected, 0 disables the limit
+    std::int64_t max_rows = 0;
+    bool promote = true;
+};
+
+struct ThreadsConfig
+{
+    ThreadsConfig() = default;
+
+    ThreadsConfig(const metricq::json& config)
+    {
+        const auto& threads = config.at("threads");
+        if (threads.is_string())
+        {
+            if (threads.get<std::string>() != "auto")
+            {
+                throw std::runtime_error("configuration error, threads must be a number or auto");
+            }
+            auto_scale = true;
+            min = 1;
+            max = std::max<int>(1, std::thread::hardware_concurrency());
+            if (config.count("auto_threads"))
+            {
+                const auto& auto_threads = config.at("auto_threads");
+                min = auto_threads.value("min", min);
+                max = auto_threads.value("max", std::max(min, max));
+                interval =
+                    std::chrono::milliseconds(auto_threads.value("interval", interval.count()));
+            }
+        }
+        else
+        {
+            min = max = threads.get<int>();
+        }
+        if (min < 1 || max < min || interval.count() <= 0)
+        {
+            throw std::runtime_error("invalid number of worker threads configured");
+        }
+    }
+
+    // scale the number of workers between min and max according to the load
+    bool auto_scale = false;
+    int min = 1;
+    int max = 1;
+    // how often the load is checked for auto scaling
+    std::chrono::milliseconds interval = std::chrono::milliseconds(1000);
+};
+
 // Most of the big methods are templated due to the Handler callback type, so this is head-only
 class AsyncHtaService
 {
 public:
     AsyncHtaService()
+    : response_cache_(stats_), read_flights_(stats_), scheduler_(stats_), admission_(stats_)
     {
     }
 
     ~AsyncHtaService()
     {
+        if (reader_pool_)
+        {
+            reader_pool_->join();
+        }
         if (pool_)
         {
+            // set right away, so that queued timer handlers no longer resize the pool
+            stopping_ = true;
+            asio::post(*flush_strand_, [this]() {
+                flush_timer_->cancel();
+                scale_timer_->cancel();
+                // from now on, every write pass also flushes
+                flush_dirty_();
+            });
             pool_->join();
         }
     }
 
-    void register_input_mapping_(const std::string& input, const std::string& name)
+private:
+    /**
+     * Immutable snapshot of the settings that can change with a reconfiguration
+     */
+    struct Settings
     {
-        if (auto it_found = mapped_metrics_.find(name); it_found != mapped_metrics_.end())
+        LoggingConfig logging;
+        FlushConfig flush;
+        SlicingConfig slicing;
+        ResponseLimitConfig response_limit;
+        // sort the values of a write pass by timestamp, so that chunks that overlap, e.g. after
+        // a producer reconnected, are merged instead of skipping the older values. This also
+        // reorders values within a chunk, and whether a late value is kept then depends on
+        // whether it arrives in the same write pass.
+        bool reorder_values = false;
+    };
+
+    /**
+     * Immutable snapshot of the input mapping. Changes copy the current snapshot and publish the
+     * modified copy, lookups only take a lock for the first use of each published snapshot.
+     */
+    struct InputMapping
+    {
+        /**
+         * mapping from a input metric name to a actual logical metric
+         * e.g. foo.bar.power.100Hz => foo.bar.power
+         * the entries point into metric_entries_ and are stable
+         */
+        std::unordered_map<std::string, MetricEntry*> inputs;
+        /**
+         * logical metric name to its entry, used for history requests
+         */
+        std::unordered_map<std::string, MetricEntry*> metrics;
+    };
+
+    /**
+     * What part of a metric a history request can see
+     */
+    struct ReadView
+    {
+        // newest value that is visible in the metric
+        hta::TimePoint until;
+        // write generation of the metric at the time of the read
+        std::uint64_t generation;
+        // false if the view might not include all values counted in the generation
+        bool current;
+    };
+
+    /**
+     * Adds a mapping to a draft of the next snapshot, must hold mapping_lock_
+     */
+    void register_input_mapping_(InputMapping& mapping, const std::string& input,
+                                 const std::string& name, const json& metric_config)
+    {
+        if (auto it_found = metric_entries_.find(name); it_found != metric_entries_.end())
         {
             Log::fatal() << "trying to map to a metric multiple times, input: " << input
                          << ", name: " << name;
             throw std::logic_error("ambiguous input, invalid configuration.");
         }
-
-        auto [it, inserted] = input_mapping_.emplace(input, name);
-        if (!inserted)
+        if (mapping.inputs.count(input))
         {
             Log::fatal() << "trying to insert the same input name twice: " << input;
             throw std::logic_error("duplicated input, invalid configuration.");
         }
-        mapped_metrics_.emplace(name);
+
+        auto [it, inserted] = metric_entries_.try_emplace(name);
+        assert(inserted);
+        auto& entry = it->second;
+        entry.name = &it->first;
+        entry.config = metric_config;
+        mapping.inputs.emplace(input, &entry);
+        mapping.metrics.emplace(name, &entry);
     }
 
-    std::string get_mapped_name_(const std::string& input)
+    /**
+     * Publishes a new snapshot, must hold mapping_lock_
+     */
+    void publish_input_mapping_(InputMapping mapping)
+    {
+        input_mapping_.store(std::make_shared<const InputMapping>(std::move(mapping)));
+    }
+
+    MetricEntry& add_input_mapping_(const std::string& input)
     {
         std::lock_guard<std::mutex> guard(mapping_lock_);
-        if (auto it = input_mapping_.find(input); it != input_mapping_.end())
+        auto current = input_mapping_.load();
+        // someone else may have added it in the meantime
+        if (auto it = current->inputs.find(input); it != current->inputs.end())
+        {
+            return *it->second;
+        }
+        // or it is about to be published by a reconfiguration
+        if (auto it = pending_inputs_.find(input); it != pending_inputs_.end())
         {
-            return it->second;
+            return *it->second;
         }
-        register_input_mapping_(input, input);
-        return input;
+        auto mapping = *current;
+        register_input_mapping_(mapping, input, input, json::object());
+        auto& entry = *mapping.inputs.at(input);
+        publish_input_mapping_(std::move(mapping));
+        return entry;
     }
 
+    /**
+     * New metrics of a reconfiguration that are opened before they are published
+     */
+    template <class Handler, class Work>
+    struct PendingMetrics
+    {
+        PendingMetrics(Handler handler, Work work)
+        : handler(std::move(handler)), work(std::move(work))
+        {
+        }
+
+        // input and entry of each new metric
+        std::vector<std::pair<std::string, MetricEntry*>> added;
+        std::atomic<std::size_t> remaining{ 0 };
+        Handler handler;
+        Work work;
+    };
+
+    /**
+     * Add the metrics of a reconfiguration that are not yet known. They are opened in parallel
+     * on their strands and only published together once all of them are ready, so that
+     * existing metrics are not blocked meanwhile.
+     */
+    template <class Handler, class Work>
+    void add_metrics_(const json& metrics, Handler handler, Work work)
+    {
+        auto pending =
+            std::make_shared<PendingMetrics<Handler, Work>>(std::move(handler), std::move(work));
+        {
+            std::lock_guard<std::mutex> guard(mapping_lock_);
+            // draft to check the new metrics for conflicts, the actual snapshot is created
+            // when they are published
+            auto mapping = *input_mapping_.load();
+            for (const auto& [input, entry] : pending_inputs_)
+            {
+                mapping.inputs.emplace(input, entry);
+            }
+            for (const auto& elem : metrics.items())
+            {
+                std::string name = elem.key();
+                const auto& metric_config = elem.value();
+
+                auto input = name;
+                if (metric_config.count("input"))
+                {
+                    input = metric_config.at("input").get<std::string>();
+                }
+                if (metric_entries_.count(name))
+                {
+                    // metric already defined
+                    // TODO check for consistent input mapping
+                    continue;
+                }
+
+                Log::info() << "adding new metric " << name;
+                register_input_mapping_(mapping, input, name, metric_config);
+                auto entry = mapping.inputs.at(input);
+                pending_inputs_.emplace(input, entry);
+                pending->added.emplace_back(input, entry);
+            }
+        }
+
+        if (pending->added.empty())
+        {
+            publish_pending_(*pending);
+            return;
+        }
+        pending->remaining = pending->added.size();
+        for (const auto& [input, entry] : pending->added)
+        {
+            auto handle = entry->acquire(pool_->get_executor());
+            auto& strand = handle->strand();
+            asio::post(strand, [this, handle = std::move(handle), pending]() {
+                try
+                {
+                    open_metric_(*handle);
+                }
+                catch (std::exception& e)
+                {
+                    // published anyway, the error is reported again on first use
+                    Log::error() << "[" << handle->name()
+                                 << "] failed to open new metric: " << e.what();
+                }
+                if (pending->remaining.fetch_sub(1) == 1)
+                {
+                    publish_pending_(*pending);
+                }
+            });
+        }
+    }
+
+    template <class Handler, class Work>
+    void publish_pending_(PendingMetrics<Handler, Work>& pending)
+    {
+        {
+            std::lock_guard<std::mutex> guard(mapping_lock_);
+            // inputs may have been added since the draft was taken
+            auto mapping = *input_mapping_.load();
+            for (const auto& [input, entry] : pending.added)
+            {
+                mapping.inputs.emplace(input, entry);
+                mapping.metrics.emplace(*entry->name, entry);
+                pending_inputs_.erase(input);
+            }
+            publish_input_mapping_(std::move(mapping));
+        }
+        Log::debug() << "published " << pending.added.size() << " new metrics";
+        pending.handler(get_subscribe_metrics());
+    }
+
+    /**
+     * @return the entry of the logical metric for an input, the reference stays valid for the
+     *         lifetime of the service
+     */
+    MetricEntry& get_input_entry_(const std::string& input)
+    {
+        const auto& mapping = input_mapping_.get();
+        if (auto it = mapping.inputs.find(input); it != mapping.inputs.end())
+        {
+            return *it->second;
+        }
+        // slow path for unknown inputs
+        return add_input_mapping_(input);
+    }
+
+public:
     template <class Handler>
     void async_config(const json& config, Handler handler)
     {
         // TODO break down this method to smaller pieces
-        int threads = config.at("threads");
+        ThreadsConfig threads_config{ config };
+        int reader_threads = config.value("reader_threads", 0);
 
         const auto& metrics = config.at("metrics");
         if (!metrics.is_object())
@@ -163,28 +541,78 @@ public:
                 // Not supported by db.subscribe in the manager at the moment
                 throw std::runtime_error("adding prefix metrics no longer supported");
             }
+            if (metric_config.count("compression") &&
+                metric_config.at("compression").get<std::string>() != "none")
+            {
+                // the storage format is owned by hta, which only writes fixed-size raw records
+                throw std::runtime_error("compressed raw storage is not supported by hta");
+            }
+            if (metric_config.count("retention"))
+            {
+                // hta can't drop data from a metric, so nothing would ever expire
+                throw std::runtime_error("retention policies are not supported by hta");
+            }
         }
 
-        logging_ = LoggingConfig{ config };
+        auto settings = std::make_shared<Settings>();
+        settings->logging = LoggingConfig{ config };
+        settings->flush = FlushConfig{ config };
+        SchedulerConfig scheduler_config{ config };
+        if (scheduler_config.reserved_read_threads >= threads_config.min)
+        {
+            throw std::runtime_error("configuration error, at least one thread must be left for "
+                                     "writes after reserved_read_threads");
+        }
+        settings->slicing = SlicingConfig{ config, reader_threads };
+        settings->response_limit = ResponseLimitConfig{ config };
+        settings->reorder_values = config.value("reorder_values", false);
+        settings_.store(std::move(settings));
+        std::size_t cache_size = 0;
+        if (config.count("cache"))
+        {
+            cache_size = config.at("cache").value("size", cache_size);
+        }
+        response_cache_.resize(cache_size);
+        auto max_open_metrics = config.value("max_open_metrics", std::int64_t(0));
+        if (max_open_metrics < 0)
+        {
+            throw std::runtime_error("configuration error, invalid max_open_metrics");
+        }
+        max_open_metrics_ = max_open_metrics;
+        admission_.configure(AdmissionConfig{ config });
 
         if (!pool_)
         {
             // Initial configure
-            if (threads < 1)
+            if (reader_threads < 0)
+            {
+                throw std::runtime_error("invalid number of reader threads configured");
+            }
+            scheduler_.configure(scheduler_config, threads_config.min);
+            pool_ = std::make_unique<WorkerPool>(threads_config.min);
+            threads_ = threads_config;
+            if (reader_threads > 0)
             {
-                throw std::runtime_error("invalid number of worker threads configured");
+                Log::info() << "using " << reader_threads << " threads for concurrent reads";
+                reader_pool_ = std::make_unique<asio::thread_pool>(reader_threads);
             }
-            pool_ = std::make_unique<asio::thread_pool>(threads);
-            pool_threads_ = threads;
+            reader_threads_ = reader_threads;
+            directory_config_ = config;
+            directory_config_.erase("metrics");
+            flush_strand_ = std::make_unique<asio::strand<WorkerPool::executor_type>>(
+                pool_->get_executor());
+            flush_timer_ = std::make_unique<asio::steady_timer>(*flush_strand_);
+            start_flush_timer_();
+            scale_timer_ = std::make_unique<asio::steady_timer>(*flush_strand_);
+            start_scale_timer_();
 
             auto work = asio::make_work_guard(handler);
-            asio::post(*pool_, [this, config, work, handler = std::move(handler)]() mutable {
-                Log::info() << "setting up HTA::Directory";
+            auto executor = pool_->get_executor();
+            asio::post(executor, [this, config, work, handler = std::move(handler)]() mutable {
+                // metrics are only opened on first use, so this doesn't touch any files
+                Log::info() << "setting up metric mapping";
                 std::lock_guard<std::mutex> guard(mapping_lock_);
-
-                assert(!directory);
-                directory = std::make_unique<hta::Directory>(config, true);
-
+                auto mapping = *input_mapping_.load();
                 // setup special write mapping
                 const auto& metrics = config.at("metrics");
                 for (const auto& elem : metrics.items())
@@ -196,165 +624,410 @@ public:
                     {
                         input = metric_config.at("input").get<std::string>();
                     }
-                    register_input_mapping_(input, name);
+                    register_input_mapping_(mapping, input, name, metric_config);
                 }
+                publish_input_mapping_(std::move(mapping));
 
-                Log::debug() << "async directory complete";
+                Log::debug() << "async mapping complete";
                 handler(get_subscribe_metrics());
             });
         }
         else
         {
             // Reconfigure
-            if (threads != this->pool_threads_)
+            if (reader_threads != this->reader_threads_)
             {
-                throw std::runtime_error("changing the number of threads with reconfigure is not "
-                                         "supported, restarting");
+                throw std::runtime_error("changing the number of reader threads with reconfigure "
+                                         "is not supported, restarting");
             }
+            auto threads = std::clamp(pool_->size(), threads_config.min, threads_config.max);
+            scheduler_.configure(scheduler_config, threads);
+            // resizing is serialized with the auto scaling on the flush strand
+            asio::post(*flush_strand_, [this, threads_config, threads]() {
+                threads_ = threads_config;
+                resize_workers_(threads);
+            });
             // Careful, this is tricky
             // We can't just remake the entire directory, this would mess with in-flight operations
             // But it's also easy to get into a deadlock situation if we try to make a big r/w lock
             // So for now, we only support *adding* metrics. This should be fine.
             Log::debug() << "updated config received, posting to async handler";
             auto work = asio::make_work_guard(handler);
-            asio::post(*pool_, [this, config, work, handler = std::move(handler)]() mutable {
-                std::lock_guard<std::mutex> guard(mapping_lock_);
+            auto executor = pool_->get_executor();
+            asio::post(executor, [this, config, work, handler = std::move(handler)]() mutable {
                 Log::info() << "handling dynamic reconfiguration";
-                const auto& metrics = config.at("metrics");
-                for (const auto& elem : metrics.items())
-                {
-                    std::string name = elem.key();
-                    const auto& metric_config = elem.value();
-
-                    auto input = name;
-                    if (metric_config.count("input"))
-                    {
-                        input = metric_config.at("input").get<std::string>();
-                    }
-                    if (mapped_metrics_.count(name))
-                    {
-                        // metric already defined
-                        // TODO check for consistent input mapping
-                        continue;
-                    }
-
-                    Log::info() << "adding new metric " << name;
-                    directory->emplace(name, metric_config);
-                    register_input_mapping_(input, name);
-                }
-                handler(get_subscribe_metrics());
+                add_metrics_(config.at("metrics"), std::move(handler), std::move(work));
             });
         }
     }
 
 private:
-    template <typename Handler>
-    void write_(const std::string& id, const metricq::DataChunk& chunk, TimePoint pending_since,
-                Handler handler)
+    /**
+     * Writes all chunks that are queued for the metric in one pass with a single flush.
+     * Must be called on the metric's strand.
+     */
+    void write_(MetricHandle& handle)
     {
-        auto stats = DbStatsWriteTransaction(stats_, pending_since);
+        const auto& id = handle.name();
+        auto& queue = handle.writes();
+        auto& writes = queue.take();
+        auto stats = DbStatsWriteTransaction(stats_, RequestKind::write);
+        for (const auto& write : writes)
+        {
+            stats.add(write.pending_since);
+        }
 
-        assert(directory);
-        auto& metric = (*directory)[id];
-        auto max_ts = metric.range().second;
-        uint64_t skip_non_monotonic = 0;
-        uint64_t skip_nan = 0;
-        uint64_t skip_inf = 0;
-        for (TimeValue tv : chunk)
+        // a copy, the reference from get() is only valid until the next lookup on this thread
+        const auto settings = settings_.get();
+        // scratch buffer reused across write passes on this thread
+        thread_local ChunkBuffer merged;
+        // a single chunk is filtered in its own buffer, it is released after the pass anyway
+        auto& values = writes.size() == 1 ? *writes.front().chunk : merged;
+        if (writes.size() > 1)
         {
-            if (tv.htv.time <= max_ts)
-            {
-                skip_non_monotonic++;
-                continue;
-            }
-            if (std::isnan(tv.htv.value))
+            merged.clear();
+            // in arrival order, so values that aren't newer than their predecessor are skipped
+            // just like within a single chunk
+            for (const auto& write : writes)
             {
-                skip_nan++;
-                continue;
-            }
-            if (std::isinf(tv.htv.value))
-            {
-                skip_inf++;
-                continue;
+                merged.append(*write.chunk);
             }
-            max_ts = tv.htv.time;
+        }
+        if (settings.reorder_values && !values.sorted())
+        {
+            values.sort();
+        }
+
+        auto& metric = open_metric_(handle);
+        auto frontier = handle.frontier();
+        auto filtered = filter_values(values.time.data(), values.value.data(), values.size(),
+                                      frontier.time_since_epoch().count());
+        auto skip_non_monotonic = filtered.skip_non_monotonic;
+        auto skip_nan = filtered.skip_nan;
+        auto skip_inf = filtered.skip_inf;
+        auto inserted = filtered.accepted;
+        for (std::size_t i = 0; i < inserted; i++)
+        {
+            hta::TimeValue tv{ hta::TimePoint(hta::Duration(values.time[i])), values.value[i] };
             try
             {
                 metric.insert(tv);
             }
             catch (std::exception& ex)
             {
-                Log::fatal() << "[" << id << "] failed to insert ts: " << tv.htv.time
-                             << ", value: " << tv.htv.value;
+                Log::fatal() << "[" << id << "] failed to insert ts: " << tv.time
+                             << ", value: " << tv.value;
                 throw;
             }
         }
-        if (logging_.non_monotonic_values && skip_non_monotonic > 0)
+        if (settings.logging.non_monotonic_values && skip_non_monotonic > 0)
         {
             Log::warn() << "[" << id << "] skipped " << skip_non_monotonic << " non-monotonic of "
-                        << chunk.value_size() << " values";
+                        << values.size() << " values";
         }
-        if (logging_.nan_values && skip_nan > 0)
+        if (settings.logging.nan_values && skip_nan > 0)
         {
-            Log::warn() << "[" << id << "] skipped " << skip_nan << " NaNs of "
-                        << chunk.value_size() << " values";
+            Log::warn() << "[" << id << "] skipped " << skip_nan << " NaNs of " << values.size()
+                        << " values";
         }
-        if (logging_.inf_values && skip_inf > 0)
+        if (settings.logging.inf_values && skip_inf > 0)
         {
             Log::warn() << "[" << id << "] skipped " << skip_inf << " +/-Infs of "
-                        << chunk.value_size() << " values";
+                        << values.size() << " values";
         }
 
-        metric.flush();
+        if (inserted > 0)
+        {
+            auto last = hta::TimePoint(hta::Duration(values.time[inserted - 1]));
+            handle.advance(hta::TimePoint(hta::Duration(values.time[0])), last, inserted);
+            handle.last_value.store({ last, values.value[inserted - 1] });
+        }
+        handle.counters.write_chunks.fetch_add(writes.size(), std::memory_order_relaxed);
+        handle.counters.write_values.fetch_add(inserted, std::memory_order_relaxed);
+        handle.counters.skip_non_monotonic.fetch_add(skip_non_monotonic, std::memory_order_relaxed);
+        handle.counters.skip_nan.fetch_add(skip_nan, std::memory_order_relaxed);
+        handle.counters.skip_inf.fetch_add(skip_inf, std::memory_order_relaxed);
+
+        queue.inserted(inserted);
+        if (flush_due_(queue, settings.flush))
+        {
+            metric.flush();
+            queue.flushed();
+            handle.flushed();
+        }
         // We compute raw size of TimeValues and ignore skipped elements for now
-        size_t data_size = chunk.value_size() * sizeof(TimeValue);
+        size_t data_size = values.size() * sizeof(TimeValue);
         auto duration = stats.completed(data_size);
+        handle.counters.write_bytes.fetch_add(data_size, std::memory_order_relaxed);
+        handle.counters.write_active_ns.fetch_add(duration.count(), std::memory_order_relaxed);
         if (duration > std::chrono::seconds(1))
         {
             Log::warn()
-                << "[" << id << "] on_data with " << chunk.value_size() << " entries took "
+                << "[" << id << "] on_data with " << writes.size() << " chunks, " << values.size()
+                << " entries took "
                 << std::chrono::duration_cast<std::chrono::duration<float>>(duration).count()
                 << " s";
         }
         else
         {
-            Log::debug() << "[" << id << "] on_data with " << chunk.value_size() << " entries took "
+            Log::debug() << "[" << id << "] on_data with " << writes.size() << " chunks, "
+                         << values.size() << " entries took "
                          << std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(
                                 duration)
                                 .count()
                          << " ms";
         }
-        handler();
+        admission_.written(data_size);
+        if (admission_.metric_over_limit(queue.backlog()))
+        {
+            // hold back until the backlog of this metric has been written
+            for (auto& write : writes)
+            {
+                queue.hold(std::move(write.completion));
+                stats_.write_throttled();
+            }
+        }
+        else
+        {
+            for (auto& completion : queue.release_held())
+            {
+                admission_.complete(std::move(completion));
+            }
+            for (auto& write : writes)
+            {
+                admission_.complete(std::move(write.completion));
+            }
+        }
+        // return the chunk buffers to the pool, values may refer to one of them
+        writes.clear();
+        // keep the merge buffer for the next pass unless an unusual burst made it huge
+        merged.trim(16 * 1024 * 1024);
+    }
+
+    bool flush_due_(WriteQueue& queue, const FlushConfig& flush) const
+    {
+        if (stopping_)
+        {
+            return true;
+        }
+        switch (flush.policy)
+        {
+        case FlushConfig::Policy::chunk:
+            return true;
+        case FlushConfig::Policy::values:
+            return queue.unflushed_values() >= flush.values;
+        case FlushConfig::Policy::interval:
+            return queue.since_flush() >= flush.interval;
+        case FlushConfig::Policy::idle:
+            return queue.idle();
+        }
+        return true;
+    }
+
+    /**
+     * Post a flush to the strand of every metric that has unflushed values older than the
+     * configured interval, or of every dirty metric while shutting down
+     */
+    void flush_dirty_()
+    {
+        auto interval = settings_.get().flush.interval;
+        for (const auto& [name, entry] : input_mapping_.load()->metrics)
+        {
+            auto handle = entry->dirty();
+            if (!handle)
+            {
+                continue;
+            }
+            asio::post(handle->strand(), [this, handle, interval]() {
+                auto& queue = handle->writes();
+                if (!queue.dirty() || (!stopping_ && queue.since_flush() < interval))
+                {
+                    return;
+                }
+                Log::debug() << "[" << handle->name() << "] background flush of "
+                             << queue.unflushed_values() << " values";
+                handle->metric().flush();
+                queue.flushed();
+                handle->flushed();
+            });
+        }
+    }
+
+    /**
+     * Release cached handles of metrics that haven't been used for a while, and of the least
+     * recently used ones while more than max_open_metrics are open
+     */
+    void evict_unused_handles_()
+    {
+        size_t evicted = 0;
+        std::size_t max_open = max_open_metrics_;
+        std::vector<std::pair<std::chrono::steady_clock::duration, MetricEntry*>> open;
+        for (const auto& [name, entry] : input_mapping_.load()->metrics)
+        {
+            if (entry->evict(handle_unused_timeout))
+            {
+                evicted++;
+            }
+            else if (max_open > 0)
+            {
+                if (auto unused_for = entry->open_unused_for())
+                {
+                    open.emplace_back(*unused_for, entry);
+                }
+            }
+        }
+        if (max_open > 0 && open.size() > max_open)
+        {
+            auto excess = open.size() - max_open;
+            // least recently used first, metrics in use or with unflushed values are skipped
+            std::sort(open.begin(), open.end(),
+                      [](const auto& a, const auto& b) { return a.first > b.first; });
+            for (auto it = open.begin(); it != open.end() && excess > 0; ++it)
+            {
+                if (it->second->evict(std::chrono::steady_clock::duration::zero()))
+                {
+                    evicted++;
+                    excess--;
+                }
+            }
+        }
+        if (evicted > 0)
+        {
+            Log::debug() << "released " << evicted << " unused metric handles";
+        }
+    }
+
+    void start_flush_timer_()
+    {
+        flush_timer_->expires_after(settings_.get().flush.interval);
+        flush_timer_->async_wait([this](auto error) {
+            if (error || stopping_)
+            {
+                return;
+            }
+            flush_dirty_();
+            evict_unused_handles_();
+            start_flush_timer_();
+        });
+    }
+
+    void start_scale_timer_()
+    {
+        scale_timer_->expires_after(threads_.interval);
+        scale_timer_->async_wait([this](auto error) {
+            if (error || stopping_)
+            {
+                return;
+            }
+            scale_workers_();
+            start_scale_timer_();
+        });
+    }
+
+    /**
+     * Add workers while all of them are busy and work is queued, remove them while they are
+     * mostly idle. Must be called on the flush strand.
+     */
+    void scale_workers_()
+    {
+        auto load = scheduler_.take_load();
+        if (!threads_.auto_scale)
+        {
+            return;
+        }
+        auto current = pool_->size();
+        auto utilization = load.busy / current;
+        auto threads = current;
+        if (load.queued > 0 && utilization > 0.9)
+        {
+            threads = std::min(threads_.max, current + std::max(1, current / 4));
+        }
+        else if (load.queued == 0 && utilization < 0.5)
+        {
+            threads = std::max(threads_.min, current - 1);
+        }
+        if (threads != current)
+        {
+            Log::info() << "scaling worker threads from " << current << " to " << threads
+                        << " at a utilization of " << utilization;
+            resize_workers_(threads);
+        }
+    }
+
+    /**
+     * Must be called on the flush strand
+     */
+    void resize_workers_(int threads)
+    {
+        if (stopping_ || threads == pool_->size())
+        {
+            return;
+        }
+        scheduler_.resize(threads);
+        pool_->resize(threads);
+    }
+
+    void schedule_write_(std::shared_ptr<MetricHandle> handle)
+    {
+        auto& strand = handle->strand();
+        scheduler_.post(WorkClass::write, strand, [this, handle = std::move(handle)]() mutable {
+            this->write_(*handle);
+            if (handle->writes().finish())
+            {
+                this->schedule_write_(std::move(handle));
+            }
+        });
     }
 
 public:
     template <class Handler>
     void async_write(const std::string& input, const metricq::DataChunk& chunk, Handler handler)
     {
-        // note we copy the chunk here as its a reused buffer owned by the original sink
-        std::string name = get_mapped_name_(input);
+        assert(pool_);
+        auto handle = get_input_entry_(input).acquire(pool_->get_executor());
 
         auto pending_since = Clock::now();
+        // decode right away as the chunk is a reused buffer owned by the original sink
+        auto buffer = chunk_pool_.acquire();
+        if (!buffer->assign(chunk))
+        {
+            Log::error() << "[" << handle->name() << "] dropping malformed chunk with "
+                         << chunk.time_delta_size() << " timestamps and " << chunk.value_size()
+                         << " values";
+            handler();
+            return;
+        }
         stats_.write_pending();
-        asio::post(get_strand(name),
-                   [this, name, chunk, pending_since, handler = std::move(handler)]() mutable {
-                       this->write_(name, chunk, pending_since, std::move(handler));
-                   });
+        admission_.admit(buffer->size() * sizeof(TimeValue));
+        if (handle->writes().push({ std::move(buffer), pending_since, std::move(handler) }))
+        {
+            schedule_write_(std::move(handle));
+        }
     }
 
 private:
     template <typename Handler>
-    void read_(const std::string& id, const metricq::HistoryRequest& content,
-               TimePoint pending_since, Handler& handler)
+    void read_(MetricHandle& handle, hta::Metric& metric, ReadView view,
+               const metricq::HistoryRequest& content,
+               const std::optional<ResponseCache::Key>& cache_key, TimePoint pending_since,
+               Handler& handler)
     {
-        auto stats = DbStatsReadTransaction(stats_, pending_since);
+        auto stats = DbStatsReadTransaction(stats_, pending_since, request_kind_(content));
 
-        metricq::HistoryResponse response;
-        response.set_metric(id);
-
-        Log::trace() << "on_history get metric";
-        auto& metric = (*directory)[id];
+        ArenaResponse response;
+        response->set_metric(handle.name());
+        auto data_size = retrieve_(handle, metric, content, *response);
+        respond_(handle, view, content, cache_key, *response, data_size, stats, handler);
+    }
 
+    /**
+     * Retrieve the data for a history request from the metric into the response
+     * @return the raw size of the retrieved data
+     */
+    size_t retrieve_(MetricHandle& handle, hta::Metric& metric,
+                     const metricq::HistoryRequest& content, metricq::HistoryResponse& response)
+    {
+        const auto& id = handle.name();
         size_t data_size = 0;
         switch (content.type())
         {
@@ -373,20 +1046,7 @@ private:
 
             hta::TimePoint last_time;
             Log::trace() << "on_history build response";
-            for (auto row : rows)
-            {
-                auto time_delta =
-                    std::chrono::duration_cast<std::chrono::nanoseconds>(row.time - last_time);
-                response.add_time_delta(time_delta.count());
-                auto aggregate = response.add_aggregate();
-                aggregate->set_minimum(row.aggregate.minimum);
-                aggregate->set_maximum(row.aggregate.maximum);
-                aggregate->set_sum(row.aggregate.sum);
-                aggregate->set_count(row.aggregate.count);
-                aggregate->set_integral(row.aggregate.integral);
-                aggregate->set_active_time(row.aggregate.active_time.count());
-                last_time = row.time;
-            }
+            add_rows_(response, rows, last_time);
             data_size = sizeof(decltype(rows)::value_type) * rows.size();
         }
         break;
@@ -406,26 +1066,15 @@ private:
             hta::TimePoint last_time;
             if (auto rows_p = std::get_if<std::vector<hta::Row>>(&flex))
             {
-                for (auto row : *rows_p)
-                {
-                    auto time_delta =
-                        std::chrono::duration_cast<std::chrono::nanoseconds>(row.time - last_time);
-                    response.add_time_delta(time_delta.count());
-                    auto aggregate = response.add_aggregate();
-                    aggregate->set_minimum(row.aggregate.minimum);
-                    aggregate->set_maximum(row.aggregate.maximum);
-                    aggregate->set_sum(row.aggregate.sum);
-                    aggregate->set_count(row.aggregate.count);
-                    aggregate->set_integral(row.aggregate.integral);
-                    aggregate->set_active_time(row.aggregate.active_time.count());
-                    last_time = row.time;
-                }
+                add_rows_(response, *rows_p, last_time);
                 data_size = sizeof(hta::Row) * rows_p->size();
             }
             else
             {
                 const auto& rows = std::get<std::vector<hta::TimeValue>>(flex);
-                for (auto tv : rows)
+                response.mutable_time_delta()->Reserve(rows.size());
+                response.mutable_value()->Reserve(rows.size());
+                for (const auto& tv : rows)
                 {
                     auto time_delta =
                         std::chrono::duration_cast<std::chrono::nanoseconds>(tv.time - last_time);
@@ -473,6 +1122,7 @@ private:
             if (data.size() == 1)
             {
                 auto tv = data.back();
+                handle.last_value.store(tv);
 
                 response.add_time_delta(tv.time.time_since_epoch().count());
                 response.add_value(tv.value);
@@ -484,13 +1134,70 @@ private:
                                "point in metric '"
                             << id << "'";
             }
+            else
+            {
+                handle.last_value.store_empty();
+            }
         }
         break;
         default:
             Log::warn() << "got unknown HistoryRequest type";
         }
+        return data_size;
+    }
+
+    /**
+     * Append aggregate rows to a response, last_time is the time of the previous row
+     */
+    static void add_rows_(metricq::HistoryResponse& response, const std::vector<hta::Row>& rows,
+                          hta::TimePoint& last_time)
+    {
+        auto size = response.time_delta_size() + static_cast<int>(rows.size());
+        response.mutable_time_delta()->Reserve(size);
+        response.mutable_aggregate()->Reserve(size);
+        for (const auto& row : rows)
+        {
+            auto time_delta =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(row.time - last_time);
+            response.add_time_delta(time_delta.count());
+            auto aggregate = response.add_aggregate();
+            aggregate->set_minimum(row.aggregate.minimum);
+            aggregate->set_maximum(row.aggregate.maximum);
+            aggregate->set_sum(row.aggregate.sum);
+            aggregate->set_count(row.aggregate.count);
+            aggregate->set_integral(row.aggregate.integral);
+            aggregate->set_active_time(row.aggregate.active_time.count());
+            last_time = row.time;
+        }
+    }
+
+    /**
+     * Cache and send a finished response
+     */
+    template <typename Handler>
+    void respond_(MetricHandle& handle, const ReadView& view,
+                  const metricq::HistoryRequest& content,
+                  const std::optional<ResponseCache::Key>& cache_key,
+                  metricq::HistoryResponse& response, size_t data_size,
+                  DbStatsReadTransaction& stats, Handler& handler)
+    {
+        const auto& id = response.metric();
+        if (cache_key)
+        {
+            // the response can't change anymore if later values can't be part of it
+            auto covered_until =
+                hta::TimePoint(hta::Duration(content.end_time() + content.interval_max()));
+            bool closed = covered_until < view.until;
+            // a snapshot may miss values that are already counted in the generation
+            if (closed || view.current)
+            {
+                response_cache_.put(*cache_key, response, view.generation, closed);
+            }
+        }
 
         auto duration = stats.completed(data_size);
+        handle.counters.read_requests.fetch_add(1, std::memory_order_relaxed);
+        handle.counters.read_active_ns.fetch_add(duration.count(), std::memory_order_relaxed);
         if (duration > std::chrono::seconds(1))
         {
             Log::warn()
@@ -518,39 +1225,593 @@ public:
         stats_.read_pending();
         auto pending_since = Clock::now();
 
-        asio::post(get_strand(id), [this, id, content, pending_since,
-                                    handler = std::move(handler)]() mutable {
+        auto handle = get_handle_(id);
+
+        if (content.type() == metricq::HistoryRequest::LAST_VALUE &&
+            read_last_value_(*handle, pending_since, handler))
+        {
+            return;
+        }
+
+        std::optional<ResponseCache::Key> cache_key;
+        auto request = content;
+        // metrics that are not open yet are checked once they are opened for the request
+        if (handle->is_open() && !limit_rows_(*handle, request, pending_since, handler))
+        {
+            return;
+        }
+        if (response_cache_.enabled() && cacheable_(request))
+        {
+            cache_key = ResponseCache::Key{ id, request.type(), request.start_time(),
+                                            request.end_time(), request.interval_max() };
+            if (auto cached = response_cache_.get(*cache_key, handle->generation()))
+            {
+                auto stats =
+                    DbStatsReadTransaction(stats_, pending_since, request_kind_(request));
+                ArenaResponse response;
+                response->CopyFrom(*cached);
+                stats.completed(response->aggregate_size() * sizeof(hta::Row) +
+                                response->value_size() * sizeof(hta::TimeValue));
+                handler(*response);
+                return;
+            }
+        }
+
+        ResponseCache::Key flight_key{ id, request.type(), request.start_time(),
+                                       request.end_time(), request.interval_max() };
+        auto kind = request_kind_(request);
+        if (read_flights_.join(flight_key, [&]() {
+                return std::make_unique<ReadWaiter<Handler>>(stats_, pending_since, kind,
+                                                             std::move(handler));
+            }))
+        {
+            return;
+        }
+        read_scheduled_(std::move(handle), std::move(request), std::move(cache_key),
+                        pending_since,
+                        FlightLeader<Handler>(read_flights_, std::move(flight_key),
+                                              std::move(handler)));
+    }
+
+private:
+    /**
+     * Schedule a history request that has to be read from the metric
+     */
+    template <class Handler>
+    void read_scheduled_(std::shared_ptr<MetricHandle> handle, metricq::HistoryRequest request,
+                         std::optional<ResponseCache::Key> cache_key, TimePoint pending_since,
+                         Handler handler)
+    {
+        auto work_class = scheduler_.classify(request);
+        if (reader_pool_ && request.type() != metricq::HistoryRequest::LAST_VALUE &&
+            handle->flushed_until())
+        {
+            if (auto slices = slices_(request, *handle->flushed_until()); slices > 1)
+            {
+                read_sliced_(work_class, std::move(handle), std::move(request),
+                             std::move(cache_key), pending_since, std::move(handler), slices);
+                return;
+            }
+            // reads on the reader pool can't delay writes, they only need the deadline check
+            auto& pool = *reader_pool_;
+            asio::post(pool, [this, work_class, handle = std::move(handle),
+                              request = std::move(request), cache_key = std::move(cache_key),
+                              pending_since, handler = std::move(handler)]() mutable {
+                this->read_checked_(work_class, *handle, request, cache_key, pending_since,
+                                    handler, true);
+            });
+            return;
+        }
+
+        auto& strand = handle->strand();
+        scheduler_.post(work_class, strand,
+                        [this, work_class, handle = std::move(handle), request = std::move(request),
+                         cache_key = std::move(cache_key), pending_since,
+                         handler = std::move(handler)]() mutable {
+                            this->read_checked_(work_class, *handle, request, cache_key,
+                                                pending_since, handler, false);
+                        });
+    }
+
+    /**
+     * Process a history request unless it expired, either on the metric's strand or
+     * concurrently on a read-only view
+     */
+    template <class Handler>
+    void read_checked_(WorkClass work_class, MetricHandle& handle,
+                       metricq::HistoryRequest& request,
+                       const std::optional<ResponseCache::Key>& cache_key, TimePoint pending_since,
+                       Handler& handler, bool snapshot)
+    {
+        if (read_expired_(work_class, request_kind_(request), handle, pending_since, handler))
+        {
+            return;
+        }
+        try
+        {
+            if (snapshot)
+            {
+                read_snapshot_(handle, request, cache_key, pending_since, handler);
+                return;
+            }
+            auto& metric = open_metric_(handle);
+            if (!limit_rows_(handle, request, pending_since, handler))
+            {
+                return;
+            }
+            auto frontier = handle.frontier();
+            if (!handle.writes().dirty())
+            {
+                // everything is on disk, concurrent reads can start from here on
+                handle.flushed();
+            }
+            read_(handle, metric, { frontier, handle.generation(), true }, request, cache_key,
+                  pending_since, handler);
+        }
+        catch (std::exception& e)
+        {
+            Log::error()
+                << "An error occurred during the handling of a history request for metricq '"
+                << handle.name() << "': " << e.what();
+
+            handler.failed(handle.name(), e.what());
+        }
+    }
+
+    /**
+     * Process a history request on a read-only view of the metric, outside of the metric's
+     * strand. The view only contains what has been flushed, so the request is limited to that.
+     */
+    template <class Handler>
+    void read_snapshot_(MetricHandle& handle, metricq::HistoryRequest& request,
+                        const std::optional<ResponseCache::Key>& cache_key,
+                        TimePoint pending_since, Handler& handler)
+    {
+        auto until = handle.flushed_until();
+        assert(until);
+        if (handle.writes().busy())
+        {
+            stats_.read_overlap();
+        }
+        auto generation = handle.generation();
+        request.set_end_time(std::min(request.end_time(), until->time_since_epoch().count()));
+
+        auto view = acquire_view_(handle, *until);
+        read_(handle, (*view.directory)[handle.name()], { *until, generation, false }, request,
+              cache_key, pending_since, handler);
+        handle.views().release(std::move(view));
+    }
+
+    /**
+     * @return a pooled read-only view that contains everything flushed until the given time, or
+     *         a newly opened one
+     */
+    ReadViews::View acquire_view_(MetricHandle& handle, hta::TimePoint until)
+    {
+        auto view = handle.views().acquire(until);
+        if (view.directory)
+        {
+            return view;
+        }
+        Log::debug() << "[" << handle.name() << "] opening read-only view";
+        // before opening, so that the view contains at least what was flushed until then
+        view.flushed_until = handle.flushed_until().value_or(until);
+        view.directory = std::make_unique<hta::Directory>(metric_directory_config_(handle), false);
+        return view;
+    }
+
+    /**
+     * @return the metric of the handle, which is opened on first use. Must be called on the
+     *         strand of the handle.
+     */
+    hta::Metric& open_metric_(MetricHandle& handle)
+    {
+        if (!handle.is_open())
+        {
+            Log::debug() << "[" << handle.name() << "] opening metric";
+            handle.open(std::make_unique<hta::Directory>(metric_directory_config_(handle), true));
+        }
+        return handle.metric();
+    }
+
+    /**
+     * @return the configuration of a directory that only contains the metric of the handle
+     */
+    json metric_directory_config_(const MetricHandle& handle) const
+    {
+        if (!handle.config())
+        {
+            throw std::runtime_error("unknown metric");
+        }
+        auto config = directory_config_;
+        config["metrics"] = json::object({ { handle.name(), *handle.config() } });
+        return config;
+    }
+
+    /**
+     * @return the number of slices a timeline request should be split into, based on the
+     * number of rows it is estimated to produce
+     */
+    std::int64_t slices_(const metricq::HistoryRequest& request, hta::TimePoint until) const
+    {
+        auto slicing = settings_.get().slicing;
+        if (slicing.rows == 0 || request.interval_max() <= 0 ||
+            (request.type() != metricq::HistoryRequest::AGGREGATE_TIMELINE &&
+             request.type() != metricq::HistoryRequest::FLEX_TIMELINE))
+        {
+            return 1;
+        }
+        auto end_time = std::min(request.end_time(), until.time_since_epoch().count());
+        // a lower bound, the chosen level may have shorter intervals than interval_max
+        auto rows = (end_time - request.start_time()) / request.interval_max();
+        return std::clamp<std::int64_t>(rows / slicing.rows, 1, slicing.max_slices);
+    }
+
+    /**
+     * Enforce max_response_rows before anything is retrieved, by promoting the request to a
+     * coarser aggregate level or by rejecting it
+     * @return false if the request was rejected
+     */
+    template <class Handler>
+    bool limit_rows_(const MetricHandle& handle, metricq::HistoryRequest& request,
+                     TimePoint pending_since, Handler& handler)
+    {
+        auto limit = settings_.get().response_limit;
+        if (limit.max_rows == 0)
+        {
+            return true;
+        }
+        const auto& estimate = handle.row_estimate();
+        auto rows = estimate.rows(request);
+        if (rows <= limit.max_rows)
+        {
+            return true;
+        }
+        if (limit.promote)
+        {
+            if (auto interval = estimate.fitting_interval(request, limit.max_rows); interval > 0)
+            {
+                Log::debug() << "[" << handle.name() << "] promoting history request of about "
+                             << rows << " rows to an interval of " << interval << " ns";
+                request.set_interval_max(interval);
+                return true;
+            }
+        }
+        // accounted as a failed read
+        auto stats = DbStatsReadTransaction(stats_, pending_since, request_kind_(request));
+        Log::warn() << "[" << handle.name() << "] rejecting history request of about " << rows
+                    << " rows";
+        handler.failed(handle.name(), "request exceeds max_response_rows");
+        return false;
+    }
+
+    /**
+     * A history request that receives the response of an equivalent request in flight
+     */
+    template <class Handler>
+    class ReadWaiter : public ReadFlights::Waiter
+    {
+    public:
+        ReadWaiter(DbStats& stats, TimePoint pending_since, RequestKind kind, Handler handler)
+        : stats_(stats), pending_since_(pending_since), kind_(kind), handler_(std::move(handler))
+        {
+        }
+
+        void respond(metricq::HistoryResponse& response) override
+        {
+            auto stats = DbStatsReadTransaction(stats_, pending_since_, kind_);
+            stats.completed(response.aggregate_size() * sizeof(hta::Row) +
+                            response.value_size() * sizeof(hta::TimeValue));
+            handler_(response);
+        }
+
+        void failed(const std::string& id, const std::string& error) override
+        {
+            // not completed, so it is counted as failed
+            auto stats = DbStatsReadTransaction(stats_, pending_since_, kind_);
+            handler_.failed(id, error);
+        }
+
+    private:
+        DbStats& stats_;
+        TimePoint pending_since_;
+        RequestKind kind_;
+        Handler handler_;
+    };
+
+    /**
+     * State of a timeline request that is split into time slices
+     */
+    template <class Handler>
+    struct SlicedRead
+    {
+        SlicedRead(DbStats& stats, TimePoint pending_since, RequestKind kind, Handler handler)
+        : pending_since(pending_since), handler(std::move(handler)),
+          stats(stats, pending_since, kind)
+        {
+        }
+
+        std::shared_ptr<MetricHandle> handle;
+        metricq::HistoryRequest request;
+        std::optional<ResponseCache::Key> cache_key;
+        ReadView view;
+        TimePoint pending_since;
+        Handler handler;
+        DbStatsReadTransaction stats;
+        // slice i covers rows starting in [bounds[i], bounds[i + 1])
+        std::vector<std::int64_t> bounds;
+        std::vector<std::variant<std::vector<hta::Row>, std::vector<hta::TimeValue>>> results;
+        std::atomic<std::size_t> remaining;
+        std::atomic<bool> checked{ false };
+        std::atomic<bool> failed{ false };
+        std::mutex error_lock;
+        std::string error;
+    };
+
+    /**
+     * Process a timeline request as disjoint time slices in parallel on read-only views.
+     * The slices are merged in order by the slice that finishes last.
+     */
+    template <class Handler>
+    void read_sliced_(WorkClass work_class, std::shared_ptr<MetricHandle> handle,
+                      metricq::HistoryRequest request,
+                      std::optional<ResponseCache::Key> cache_key, TimePoint pending_since,
+                      Handler handler, std::int64_t slices)
+    {
+        auto until = *handle->flushed_until();
+        if (handle->writes().busy())
+        {
+            stats_.read_overlap();
+        }
+        auto read = std::make_shared<SlicedRead<Handler>>(
+            stats_, pending_since, request_kind_(request), std::move(handler));
+        read->view = { until, handle->generation(), false };
+        request.set_end_time(std::min(request.end_time(), until.time_since_epoch().count()));
+
+        // align the slices to interval_max so that they start at the same rows for any request
+        auto interval = request.interval_max();
+        auto length = request.end_time() - request.start_time();
+        auto step = ((length + slices - 1) / slices + interval - 1) / interval * interval;
+        for (auto bound = request.start_time(); bound < request.end_time(); bound += step)
+        {
+            read->bounds.push_back(bound);
+        }
+        read->bounds.push_back(request.end_time());
+        read->results.resize(read->bounds.size() - 1);
+        read->remaining = read->results.size();
+        Log::debug() << "[" << handle->name() << "] splitting history request into "
+                     << read->results.size() << " slices";
+
+        read->handle = std::move(handle);
+        read->request = std::move(request);
+        read->cache_key = std::move(cache_key);
+        for (std::size_t slice = 0; slice < read->results.size(); slice++)
+        {
+            asio::post(*reader_pool_, [this, work_class, read, slice]() {
+                this->read_slice_(work_class, *read, slice);
+            });
+        }
+    }
+
+    template <class Handler>
+    void read_slice_(WorkClass work_class, SlicedRead<Handler>& read, std::size_t slice)
+    {
+        const auto& name = read.handle->name();
+        if (!read.checked.exchange(true) && scheduler_.expired(work_class, read.pending_since))
+        {
+            std::lock_guard<std::mutex> guard(read.error_lock);
+            read.error = "deadline exceeded before the request was started";
+            read.failed = true;
+        }
+        if (!read.failed)
+        {
             try
             {
-                this->read_(id, content, pending_since, handler);
+                auto view = acquire_view_(*read.handle, read.view.until);
+                auto& metric = (*view.directory)[name];
+                auto interval_max = hta::Duration(read.request.interval_max());
+                auto start_time = hta::TimePoint(hta::Duration(read.bounds[slice]));
+                auto end_time = hta::TimePoint(hta::Duration(read.bounds[slice + 1]));
+                if (slice + 1 < read.results.size())
+                {
+                    // rows that start in the slice may extend up to interval_max beyond its
+                    // end, they are trimmed when merging. The last slice ends with the request.
+                    end_time = std::min(end_time + interval_max, read.view.until);
+                }
+                if (read.request.type() == metricq::HistoryRequest::AGGREGATE_TIMELINE)
+                {
+                    read.results[slice] = metric.retrieve(start_time, end_time, interval_max);
+                }
+                else
+                {
+                    read.results[slice] = metric.retrieve_flex(start_time, end_time, interval_max);
+                }
+                read.handle->views().release(std::move(view));
             }
             catch (std::exception& e)
             {
-                Log::error()
-                    << "An error occurred during the handling of a history request for metricq '"
-                    << id << "': " << e.what();
+                std::lock_guard<std::mutex> guard(read.error_lock);
+                read.error = e.what();
+                read.failed = true;
+            }
+        }
+        if (read.remaining.fetch_sub(1) == 1)
+        {
+            finish_sliced_(read);
+        }
+    }
 
-                handler.failed(id, e.what());
+    /**
+     * Merge the slices of a sliced read and respond, called once all slices are done
+     */
+    template <class Handler>
+    void finish_sliced_(SlicedRead<Handler>& read)
+    {
+        const auto& name = read.handle->name();
+        try
+        {
+            if (read.failed)
+            {
+                throw std::runtime_error(read.error);
             }
-        });
+            ArenaResponse response;
+            response->set_metric(name);
+            hta::TimePoint last_time;
+            size_t data_size = 0;
+            for (std::size_t slice = 0; slice < read.results.size(); slice++)
+            {
+                auto rows_p = std::get_if<std::vector<hta::Row>>(&read.results[slice]);
+                if (!rows_p)
+                {
+                    // FLEX_TIMELINE returned raw values for a part of the time range, the
+                    // slices can't be merged, so the request is processed as a whole
+                    Log::debug() << "[" << name << "] sliced history request returned raw values";
+                    response->Clear();
+                    response->set_metric(name);
+                    auto view = acquire_view_(*read.handle, read.view.until);
+                    data_size =
+                        retrieve_(*read.handle, (*view.directory)[name], read.request, *response);
+                    read.handle->views().release(std::move(view));
+                    break;
+                }
+                // only keep the rows that start in the slice, the others belong to its neighbors
+                auto& rows = *rows_p;
+                if (slice + 1 < read.results.size())
+                {
+                    auto end = hta::TimePoint(hta::Duration(read.bounds[slice + 1]));
+                    rows.erase(std::lower_bound(rows.begin(), rows.end(), end,
+                                                [](const auto& row, auto time) {
+                                                    return row.time < time;
+                                                }),
+                               rows.end());
+                }
+                if (slice > 0)
+                {
+                    auto begin = hta::TimePoint(hta::Duration(read.bounds[slice]));
+                    rows.erase(rows.begin(), std::lower_bound(rows.begin(), rows.end(), begin,
+                                                              [](const auto& row, auto time) {
+                                                                  return row.time < time;
+                                                              }));
+                }
+                add_rows_(*response, rows, last_time);
+                data_size += sizeof(hta::Row) * rows.size();
+            }
+            respond_(*read.handle, read.view, read.request, read.cache_key, *response, data_size,
+                     read.stats, read.handler);
+        }
+        catch (std::exception& e)
+        {
+            Log::error()
+                << "An error occurred during the handling of a history request for metricq '"
+                << name << "': " << e.what();
+
+            read.handler.failed(name, e.what());
+        }
+    }
+
+    /**
+     * Fail a history request that waited longer than the deadline of its class
+     * @return true if the request has been failed and must not be processed
+     */
+    template <class Handler>
+    bool read_expired_(WorkClass work_class, RequestKind kind, MetricHandle& handle,
+                       TimePoint pending_since, Handler& handler)
+    {
+        if (!scheduler_.expired(work_class, pending_since))
+        {
+            return false;
+        }
+        // accounted as a failed read
+        auto stats = DbStatsReadTransaction(stats_, pending_since, kind);
+        Log::warn() << "[" << handle.name() << "] history request exceeded its deadline after "
+                    << std::chrono::duration_cast<std::chrono::duration<float>>(Clock::now() -
+                                                                                pending_since)
+                           .count()
+                    << " s";
+        handler.failed(handle.name(), "deadline exceeded before the request was started");
+        return true;
     }
 
 private:
-    asio::strand<asio::thread_pool::executor_type>& get_strand(const std::string& id)
+    /**
+     * Answer a LAST_VALUE request from the in-memory last value of the metric
+     * @return false if the last value is not yet known and must be read from storage
+     */
+    template <class Handler>
+    bool read_last_value_(MetricHandle& handle, TimePoint pending_since, Handler& handler)
+    {
+        hta::TimeValue tv;
+        auto state = handle.last_value.load(tv);
+        if (state == LastValue::State::unknown)
+        {
+            return false;
+        }
+
+        auto stats = DbStatsReadTransaction(stats_, pending_since, RequestKind::last_value);
+        metricq::HistoryResponse response;
+        response.set_metric(handle.name());
+        size_t data_size = 0;
+        if (state == LastValue::State::known)
+        {
+            response.add_time_delta(tv.time.time_since_epoch().count());
+            response.add_value(tv.value);
+            data_size = sizeof(tv);
+        }
+        stats.completed(data_size);
+        handler(response);
+        return true;
+    }
+
+    static RequestKind request_kind_(const metricq::HistoryRequest& request)
     {
-        assert(directory);
-        std::lock_guard<std::mutex> guard(strand_lock_);
-        auto it = strands_.try_emplace(id, pool_->get_executor());
-        return it.first->second;
+        switch (request.type())
+        {
+        case metricq::HistoryRequest::AGGREGATE:
+            return RequestKind::aggregate;
+        case metricq::HistoryRequest::LAST_VALUE:
+            return RequestKind::last_value;
+        case metricq::HistoryRequest::FLEX_TIMELINE:
+            return RequestKind::flex_timeline;
+        default:
+            return RequestKind::aggregate_timeline;
+        }
+    }
+
+    /**
+     * Only requests with a window aligned to interval_max are cached. Requests from clients
+     * that scroll through a timeline usually are, and widening others to aligned windows would
+     * change their response.
+     */
+    static bool cacheable_(const metricq::HistoryRequest& request)
+    {
+        auto interval = request.interval_max();
+        return (request.type() == metricq::HistoryRequest::AGGREGATE_TIMELINE ||
+                request.type() == metricq::HistoryRequest::FLEX_TIMELINE) &&
+               interval > 0 && request.start_time() % interval == 0 &&
+               request.end_time() % interval == 0;
+    }
+
+    /**
+     * @return the cached handle of a logical metric, or a temporary one for unknown metrics
+     */
+    std::shared_ptr<MetricHandle> get_handle_(const std::string& id)
+    {
+        assert(pool_);
+        const auto& mapping = input_mapping_.get();
+        if (auto it = mapping.metrics.find(id); it != mapping.metrics.end())
+        {
+            return it->second->acquire(pool_->get_executor());
+        }
+        // not cached, so that requests for arbitrary names don't accumulate state
+        return std::make_shared<MetricHandle>(id, pool_->get_executor());
     }
 
     json get_subscribe_metrics() const
     {
-        // assumes there already is a mapping_lock_
         json ret = json::array();
-        for (const auto& elem : input_mapping_)
+        for (const auto& elem : input_mapping_.load()->inputs)
         {
-            ret.push_back(json{ { "input", elem.first }, { "name", elem.second } });
+            ret.push_back(json{ { "input", elem.first }, { "name", *elem.second->name } });
         }
         return ret;
     }
@@ -561,24 +1822,60 @@ public:
         return stats_;
     }
 
-private:
-    std::unique_ptr<hta::Directory> directory;
-    std::mutex mapping_lock_;
     /**
-     * mapping from a input metric name to a actual logical metric name
-     * e.g. foo.bar.power.100Hz => foo.bar.power
+     * Publish the stats of the last interval, called periodically from the same thread
      */
-    std::unordered_map<std::string, std::string> input_mapping_;
+    void collect_stats()
+    {
+        if (stats_.hot_spots_enabled())
+        {
+            for (const auto& [name, entry] : input_mapping_.load()->metrics)
+            {
+                if (auto handle = entry->cached())
+                {
+                    stats_.metric_activity(name, handle->counters.take());
+                }
+            }
+        }
+        stats_.collect();
+    }
+
+private:
+    std::unique_ptr<WorkerPool> pool_;
+    int reader_threads_ = 0;
+    // only for concurrent reads on read-only views, not used if there are no reader threads
+    std::unique_ptr<asio::thread_pool> reader_pool_;
+    // configuration of the directory without the metrics, used to open single metrics
+    json directory_config_;
+    // must outlive the queued writes
+    ChunkBufferPool chunk_pool_;
+    // serializes changes of the input mapping, not needed for lookups
+    std::mutex mapping_lock_;
+    Published<InputMapping> input_mapping_{ std::make_shared<const InputMapping>() };
+    // inputs of new metrics that are being opened and not yet published, protected by
+    // mapping_lock_
+    std::unordered_map<std::string, MetricEntry*> pending_inputs_;
     /**
-     * set of logical metric names that are already included in the input mapping
-     * used to avoid ambiguous mappings
+     * logical metrics that are already included in the input mapping
+     * used to avoid ambiguous mappings, entries are never removed
      */
-    std::unordered_set<std::string> mapped_metrics_;
-    std::mutex strand_lock_;
-    int pool_threads_ = 0;
-    std::unique_ptr<asio::thread_pool> pool_;
-    std::map<std::string, asio::strand<asio::thread_pool::executor_type>> strands_;
+    std::unordered_map<std::string, MetricEntry> metric_entries_;
+    std::unique_ptr<asio::strand<WorkerPool::executor_type>> flush_strand_;
+    std::unique_ptr<asio::steady_timer> flush_timer_;
+    // only accessed on the flush strand after the initial configure
+    std::unique_ptr<asio::steady_timer> scale_timer_;
+    ThreadsConfig threads_;
+    std::atomic<bool> stopping_{ false };
+    // soft limit of the number of open metrics, enforced when unused handles are released
+    std::atomic<std::size_t> max_open_metrics_{ 0 };
 
     DbStats stats_;
-    LoggingConfig logging_;
+    ResponseCache response_cache_;
+    ReadFlights read_flights_;
+    Scheduler scheduler_;
+    AdmissionControl admission_;
+    // published by async_config, read like the input mapping
+    Published<Settings> settings_{ std::make_shared<const Settings>() };
+
+    static constexpr auto handle_unused_timeout = std::chrono::minutes(10);
 };
@@ -0,0 +1,320 @@
+// metricq-db-hta
+// Copyright (C) 2021 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-db-hta.
+//
+// metricq-db-hta is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-db-hta is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-db-hta.  If not, see <http://www.gnu.org/licenses/>.
+#include "async_hta_service.hpp"
+#include "log.hpp"
+
+#include <metricq/datachunk.pb.h>
+#include <metricq/history.pb.h>
+#include <metricq/json.hpp>
+
+#include <nitro/log/severity.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <unistd.h>
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Counting all allocations of the process, so that allocations per operation can be reported
+static std::atomic<std::uint64_t> allocations{ 0 };
+
+void* operator new(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (auto ptr = std::malloc(size == 0 ? 1 : size))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+namespace
+{
+/**
+ * Counts completed requests, so that a benchmark iteration can wait for all of its requests
+ */
+struct Completions
+{
+    void wait(std::uint64_t expected)
+    {
+        while (count.load(std::memory_order_acquire) < expected)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    std::atomic<std::uint64_t> count{ 0 };
+};
+
+struct WriteHandler
+{
+    void operator()()
+    {
+        completions->count.fetch_add(1, std::memory_order_release);
+    }
+
+    Completions* completions;
+};
+
+struct ReadHandler
+{
+    void operator()(metricq::HistoryResponse& response)
+    {
+        benchmark::DoNotOptimize(response.time_delta_size());
+        completions->count.fetch_add(1, std::memory_order_release);
+    }
+
+    void failed(const std::string& id, const std::string& error)
+    {
+        Log::error() << "history request for " << id << " failed: " << error;
+        completions->count.fetch_add(1, std::memory_order_release);
+    }
+
+    Completions* completions;
+};
+
+/**
+ * AsyncHtaService on a temporary directory, preferably on tmpfs
+ */
+class BenchService
+{
+public:
+    BenchService(int threads, int metrics)
+    {
+        auto base = std::filesystem::exists("/dev/shm") ? std::filesystem::path("/dev/shm") :
+                                                          std::filesystem::temp_directory_path();
+        path_ = base / ("metricq-db-hta-bench-" + std::to_string(::getpid()));
+        std::filesystem::remove_all(path_);
+        std::filesystem::create_directories(path_);
+
+        json metric_config = { { "interval_min", 1'000'000 },
+                               { "interval_max", 1'000'000'000'000 },
+                               { "interval_factor", 10 } };
+        json config = { { "threads", threads },
+                        { "path", path_.string() },
+                        { "logging", { { "nan_values", false },
+                                       { "inf_values", false },
+                                       { "non_monotonic_values", false } } },
+                        { "metrics", json::object() } };
+        for (int i = 0; i < metrics; i++)
+        {
+            names_.push_back("bench.metric" + std::to_string(i));
+            config["metrics"][names_.back()] = metric_config;
+        }
+
+        service_ = std::make_unique<AsyncHtaService>();
+        std::promise<void> configured;
+        service_->async_config(config, [&configured](const json&) { configured.set_value(); });
+        configured.get_future().get();
+    }
+
+    ~BenchService()
+    {
+        service_.reset();
+        std::filesystem::remove_all(path_);
+    }
+
+    AsyncHtaService& service()
+    {
+        return *service_;
+    }
+
+    const std::vector<std::string>& names() const
+    {
+        return names_;
+    }
+
+private:
+    std::filesystem::path path_;
+    std::vector<std::string> names_;
+    std::unique_ptr<AsyncHtaService> service_;
+};
+
+/**
+ * Generates consecutive chunks of a metric with 1 ms between values
+ */
+class ChunkGenerator
+{
+public:
+    ChunkGenerator(int size, int nan_permille, int non_monotonic_permille)
+    : size_(size), nan_permille_(nan_permille), non_monotonic_permille_(non_monotonic_permille)
+    {
+    }
+
+    const metricq::DataChunk& next()
+    {
+        chunk_.Clear();
+        std::int64_t previous = 0;
+        for (int i = 0; i < size_; i++)
+        {
+            time_ += 1'000'000;
+            auto time = time_;
+            if (permille_(random_) < non_monotonic_permille_)
+            {
+                time -= 10'000'000;
+            }
+            double value = std::sin(time * 1e-9);
+            if (permille_(random_) < nan_permille_)
+            {
+                value = NAN;
+            }
+            chunk_.add_time_delta(time - previous);
+            chunk_.add_value(value);
+            previous = time;
+        }
+        return chunk_;
+    }
+
+private:
+    int size_;
+    int nan_permille_;
+    int non_monotonic_permille_;
+    std::int64_t time_ = 1'600'000'000'000'000'000;
+    std::mt19937 random_{ 42 };
+    std::uniform_int_distribution<int> permille_{ 0, 999 };
+    metricq::DataChunk chunk_;
+};
+
+void report_allocations(benchmark::State& state, std::uint64_t begin, double operations)
+{
+    state.counters["allocs/op"] =
+        (allocations.load(std::memory_order_relaxed) - begin) / operations;
+}
+
+/**
+ * Args: chunk size, NaN per mille, non-monotonic per mille, metrics, threads
+ */
+void BM_write(benchmark::State& state)
+{
+    auto chunk_size = static_cast<int>(state.range(0));
+    auto metrics = static_cast<int>(state.range(3));
+    BenchService bench(static_cast<int>(state.range(4)), metrics);
+    std::vector<ChunkGenerator> generators(
+        metrics, ChunkGenerator(chunk_size, static_cast<int>(state.range(1)),
+                                static_cast<int>(state.range(2))));
+    Completions completions;
+    std::uint64_t chunks = 0;
+
+    auto allocations_begin = allocations.load(std::memory_order_relaxed);
+    for (auto _ : state)
+    {
+        for (int i = 0; i < metrics; i++)
+        {
+            bench.service().async_write(bench.names()[i], generators[i].next(),
+                                        WriteHandler{ &completions });
+        }
+        chunks += metrics;
+        completions.wait(chunks);
+    }
+    state.counters["values/s"] =
+        benchmark::Counter(static_cast<double>(chunks * chunk_size), benchmark::Counter::kIsRate);
+    report_allocations(state, allocations_begin, static_cast<double>(chunks));
+}
+
+BENCHMARK(BM_write)
+    ->ArgNames({ "chunk", "nan", "nonmono", "metrics", "threads" })
+    ->ArgsProduct({ { 10, 1000, 10000 }, { 0, 10 }, { 0, 10 }, { 1, 16 }, { 1, 4 } })
+    ->UseRealTime();
+
+/**
+ * Args: request type, intervals per request, threads
+ */
+void BM_read(benchmark::State& state)
+{
+    auto type = static_cast<metricq::HistoryRequest::RequestType>(state.range(0));
+    auto intervals = state.range(1);
+    BenchService bench(static_cast<int>(state.range(2)), 1);
+    const auto& name = bench.names().front();
+
+    // one hour of data at 1 kHz
+    ChunkGenerator generator(10000, 0, 0);
+    Completions written;
+    for (int i = 0; i < 360; i++)
+    {
+        bench.service().async_write(name, generator.next(), WriteHandler{ &written });
+    }
+    written.wait(360);
+
+    metricq::HistoryRequest request;
+    request.set_type(type);
+    auto start = std::int64_t(1'600'000'000'000'000'000);
+    auto end = start + std::int64_t(3600) * 1'000'000'000;
+    request.set_start_time(start);
+    request.set_end_time(end);
+    request.set_interval_max((end - start) / intervals);
+
+    Completions completions;
+    std::uint64_t requests = 0;
+    auto allocations_begin = allocations.load(std::memory_order_relaxed);
+    for (auto _ : state)
+    {
+        bench.service().async_read(name, request, ReadHandler{ &completions });
+        completions.wait(++requests);
+    }
+    state.counters["requests/s"] =
+        benchmark::Counter(static_cast<double>(requests), benchmark::Counter::kIsRate);
+    report_allocations(state, allocations_begin, static_cast<double>(requests));
+}
+
+BENCHMARK(BM_read)
+    ->ArgNames({ "type", "intervals", "threads" })
+    ->ArgsProduct({ { metricq::HistoryRequest::AGGREGATE_TIMELINE,
+                      metricq::HistoryRequest::AGGREGATE, metricq::HistoryRequest::LAST_VALUE,
+                      metricq::HistoryRequest::FLEX_TIMELINE },
+                    { 100, 10000 },
+                    { 1, 4 } })
+    ->UseRealTime();
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    metricq::logger::nitro::set_severity(nitro::log::severity_level::warn);
+    metricq::logger::nitro::initialize();
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,145 @@
+// metricq-db-hta
+// Copyright (C) 2021 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-db-hta.
+//
+// metricq-db-hta is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-db-hta is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-db-hta.  If not, see <http://www.gnu.org/licenses/>.
+#include "capture.hpp"
+
+#include "log.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+static const char capture_magic[8] = { 'M', 'Q', 'H', 'T', 'A', 'C', 'A', 'P' };
+
+template <typename T>
+static void write_raw(std::ofstream& file, T value)
+{
+    file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+static bool read_raw(std::ifstream& file, T& value)
+{
+    return static_cast<bool>(file.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+CaptureWriter::CaptureWriter(const std::string& path)
+: file_(path, std::ios::binary | std::ios::trunc)
+{
+    if (!file_)
+    {
+        throw std::runtime_error("failed to open capture file " + path);
+    }
+    file_.write(capture_magic, sizeof(capture_magic));
+}
+
+void CaptureWriter::config(const metricq::json& config)
+{
+    payload_ = config.dump();
+    write(CaptureKind::config, "");
+    if (file_.is_open())
+    {
+        // configs are rare and important for the replay, so don't keep them in the buffer
+        file_.flush();
+        check();
+    }
+}
+
+void CaptureWriter::data(const std::string& metric, const metricq::DataChunk& chunk)
+{
+    if (!file_.is_open())
+    {
+        return;
+    }
+    chunk.SerializeToString(&payload_);
+    write(CaptureKind::data, metric);
+}
+
+void CaptureWriter::history(const std::string& metric, const metricq::HistoryRequest& request)
+{
+    if (!file_.is_open())
+    {
+        return;
+    }
+    request.SerializeToString(&payload_);
+    write(CaptureKind::history, metric);
+}
+
+void CaptureWriter::write(CaptureKind kind, const std::string& name)
+{
+    if (!file_.is_open())
+    {
+        return;
+    }
+    write_raw(file_, static_cast<std::uint8_t>(kind));
+    write_raw(file_, static_cast<std::int64_t>(metricq::Clock::now().time_since_epoch().count()));
+    write_raw(file_, static_cast<std::uint32_t>(name.size()));
+    file_.write(name.data(), name.size());
+    write_raw(file_, static_cast<std::uint32_t>(payload_.size()));
+    file_.write(payload_.data(), payload_.size());
+    check();
+}
+
+void CaptureWriter::check()
+{
+    if (!file_)
+    {
+        // the capture is only a debugging aid, so a failure must not affect the db
+        Log::error() << "Failed to write to capture file, capturing is disabled";
+        file_.close();
+    }
+}
+
+CaptureReader::CaptureReader(const std::string& path) : file_(path, std::ios::binary)
+{
+    char header[sizeof(capture_magic)];
+    if (!file_ || !file_.read(header, sizeof(header)) ||
+        !std::equal(header, header + sizeof(header), capture_magic))
+    {
+        throw std::runtime_error("failed to open capture file " + path);
+    }
+}
+
+bool CaptureReader::next(CaptureRecord& record)
+{
+    std::uint8_t kind;
+    if (!read_raw(file_, kind))
+    {
+        return false;
+    }
+    std::int64_t time;
+    std::uint32_t name_size;
+    std::uint32_t payload_size;
+    if (read_raw(file_, time) && read_raw(file_, name_size))
+    {
+        record.kind = static_cast<CaptureKind>(kind);
+        record.time = metricq::TimePoint(metricq::Duration(time));
+        record.name.resize(name_size);
+        if (file_.read(record.name.data(), name_size) && read_raw(file_, payload_size))
+        {
+            record.payload.resize(payload_size);
+            if (file_.read(record.payload.data(), payload_size))
+            {
+                return true;
+            }
+        }
+    }
+    // the db was probably stopped while writing the last record
+    Log::warn() << "Capture file ends with a truncated record, stopping at the last complete one";
+    return false;
+}
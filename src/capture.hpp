@@ -0,0 +1,95 @@
+// metricq-db-hta
+// Copyright (C) 2021 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-db-hta.
+//
+// metricq-db-hta is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-db-hta is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-db-hta.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <metricq/chrono.hpp>
+#include <metricq/datachunk.pb.h>
+#include <metricq/history.pb.h>
+#include <metricq/json.hpp>
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+/*
+ * Binary capture of the requests the database received, for replaying them later.
+ *
+ * The file starts with a magic string and is followed by records of
+ *   kind (uint8), arrival time (int64, ns since epoch), name length (uint32), name,
+ *   payload length (uint32), payload
+ * in host byte order. The payload is the serialized DataChunk or HistoryRequest, or the JSON
+ * of a db config.
+ */
+enum class CaptureKind : std::uint8_t
+{
+    config = 1,
+    data = 2,
+    history = 3,
+};
+
+struct CaptureRecord
+{
+    CaptureKind kind;
+    metricq::TimePoint time;
+    // metric name, empty for config records
+    std::string name;
+    std::string payload;
+};
+
+/**
+ * Appends records to a capture file, must only be used from one thread at a time
+ */
+class CaptureWriter
+{
+public:
+    explicit CaptureWriter(const std::string& path);
+
+    void config(const metricq::json& config);
+
+    void data(const std::string& metric, const metricq::DataChunk& chunk);
+
+    void history(const std::string& metric, const metricq::HistoryRequest& request);
+
+private:
+    void write(CaptureKind kind, const std::string& name);
+
+    /**
+     * Stop capturing after a failed write
+     */
+    void check();
+
+    std::ofstream file_;
+    // reused to serialize the payload
+    std::string payload_;
+};
+
+class CaptureReader
+{
+public:
+    explicit CaptureReader(const std::string& path);
+
+    /**
+     * @return false at the end of the capture, including a truncated last record
+     */
+    bool next(CaptureRecord& record);
+
+private:
+    std::ifstream file_;
+};
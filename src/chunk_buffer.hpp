@@ -0,0 +1,217 @@
+// metricq-db-hta
+// Copyright (C) 2021 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-db-hta.
+//
+// metricq-db-hta is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-db-hta is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-db-hta.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <hta/hta.hpp>
+
+#include <metricq/datachunk.pb.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * Decoded content of a DataChunk as flat arrays of absolute timestamps and values
+ */
+struct ChunkBuffer
+{
+    /**
+     * @return false if the chunk is malformed, the buffer is empty then
+     */
+    bool assign(const metricq::DataChunk& chunk)
+    {
+        auto size = static_cast<std::size_t>(chunk.value_size());
+        if (static_cast<std::size_t>(chunk.time_delta_size()) != size)
+        {
+            clear();
+            return false;
+        }
+        time.resize(size);
+        value.resize(size);
+        const auto* time_delta = chunk.time_delta().data();
+        std::int64_t t = 0;
+        for (std::size_t i = 0; i < size; i++)
+        {
+            t += time_delta[i];
+            time[i] = t;
+        }
+        std::copy_n(chunk.value().data(), size, value.begin());
+        return true;
+    }
+
+    void append(const ChunkBuffer& other)
+    {
+        time.insert(time.end(), other.time.begin(), other.time.end());
+        value.insert(value.end(), other.value.begin(), other.value.end());
+    }
+
+    void clear()
+    {
+        time.clear();
+        value.clear();
+    }
+
+    std::size_t size() const
+    {
+        return time.size();
+    }
+
+    /**
+     * @return the memory held by the buffer, including unused capacity
+     */
+    std::size_t bytes() const
+    {
+        return time.capacity() * sizeof(std::int64_t) + value.capacity() * sizeof(double) +
+               order.capacity() * sizeof(std::size_t);
+    }
+
+    /**
+     * Clear the buffer and free its memory if it holds more than max_bytes
+     */
+    void trim(std::size_t max_bytes)
+    {
+        clear();
+        if (bytes() > max_bytes)
+        {
+            time = {};
+            value = {};
+            order = {};
+        }
+    }
+
+    bool sorted() const
+    {
+        return std::is_sorted(time.begin(), time.end());
+    }
+
+    /**
+     * Sort by time in place, values with the same timestamp keep their order.
+     * Sorts a permutation of indices and then applies it by following its cycles, so only the
+     * reused index array is needed besides the buffer itself.
+     */
+    void sort()
+    {
+        order.resize(size());
+        for (std::size_t i = 0; i < order.size(); i++)
+        {
+            order[i] = i;
+        }
+        // ties are broken by the index, which makes the unstable sort stable
+        std::sort(order.begin(), order.end(), [this](std::size_t lhs, std::size_t rhs) {
+            return time[lhs] < time[rhs] || (time[lhs] == time[rhs] && lhs < rhs);
+        });
+        // order[i] is the index of the element that belongs to position i
+        for (std::size_t start = 0; start < order.size(); start++)
+        {
+            if (order[start] == start)
+            {
+                continue;
+            }
+            auto start_time = time[start];
+            auto start_value = value[start];
+            auto i = start;
+            while (order[i] != start)
+            {
+                auto next = order[i];
+                time[i] = time[next];
+                value[i] = value[next];
+                order[i] = i;
+                i = next;
+            }
+            time[i] = start_time;
+            value[i] = start_value;
+            order[i] = i;
+        }
+    }
+
+    // nanoseconds since epoch
+    std::vector<std::int64_t> time;
+    std::vector<double> value;
+    // scratch space of sort()
+    std::vector<std::size_t> order;
+};
+
+/**
+ * Free list of ChunkBuffers, so that in a steady state no memory is allocated for incoming
+ * chunks. Buffers keep their capacity while they are in the pool. The pool only retains buffers
+ * up to a total of max_bytes, so that a burst of chunks doesn't pin its memory.
+ */
+class ChunkBufferPool
+{
+public:
+    struct Release
+    {
+        void operator()(ChunkBuffer* buffer) const
+        {
+            pool->release(buffer);
+        }
+
+        ChunkBufferPool* pool;
+    };
+
+    using Handle = std::unique_ptr<ChunkBuffer, Release>;
+
+    explicit ChunkBufferPool(std::size_t max_bytes = 64 * 1024 * 1024) : max_bytes_(max_bytes)
+    {
+        free_.reserve(1024);
+    }
+
+    ChunkBufferPool(const ChunkBufferPool&) = delete;
+
+    ChunkBufferPool& operator=(const ChunkBufferPool&) = delete;
+
+    Handle acquire()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            if (!free_.empty())
+            {
+                Handle buffer(free_.back().release(), Release{ this });
+                free_.pop_back();
+                free_bytes_ -= buffer->bytes();
+                return buffer;
+            }
+        }
+        return Handle(new ChunkBuffer(), Release{ this });
+    }
+
+private:
+    void release(ChunkBuffer* buffer)
+    {
+        std::unique_ptr<ChunkBuffer> owned(buffer);
+        owned->clear();
+        auto bytes = owned->bytes();
+        std::lock_guard<std::mutex> guard(lock_);
+        if (free_bytes_ + bytes <= max_bytes_)
+        {
+            free_.push_back(std::move(owned));
+            free_bytes_ += bytes;
+        }
+    }
+
+    std::mutex lock_;
+    std::vector<std::unique_ptr<ChunkBuffer>> free_;
+    // memory held by the buffers in free_
+    std::size_t free_bytes_ = 0;
+    std::size_t max_bytes_;
+};
@@ -0,0 +1,178 @@
+// metricq-db-hta
+// Copyright (C) 2021 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-db-hta.
+//
+// metricq-db-hta is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-db-hta is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-db-hta.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "chunk_filter.hpp"
+
+#include <cmath>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define DB_HTA_FILTER_AVX2
+#include <immintrin.h>
+#endif
+
+namespace
+{
+/**
+ * Processes a single value, returns the new position to write the next accepted value to
+ */
+inline std::size_t filter_one(std::int64_t* time, double* value, std::size_t index,
+                              std::size_t out, std::int64_t& last, FilterResult& result)
+{
+    auto t = time[index];
+    auto v = value[index];
+    if (t <= last)
+    {
+        result.skip_non_monotonic++;
+        return out;
+    }
+    if (std::isnan(v))
+    {
+        result.skip_nan++;
+        return out;
+    }
+    if (std::isinf(v))
+    {
+        result.skip_inf++;
+        return out;
+    }
+    last = t;
+    time[out] = t;
+    value[out] = v;
+    return out + 1;
+}
+
+FilterResult filter_scalar(std::int64_t* time, double* value, std::size_t size,
+                           std::int64_t frontier)
+{
+    FilterResult result;
+    std::size_t out = 0;
+    for (std::size_t i = 0; i < size; i++)
+    {
+        out = filter_one(time, value, i, out, frontier, result);
+    }
+    result.accepted = out;
+    return result;
+}
+
+#ifdef DB_HTA_FILTER_AVX2
+/**
+ * Permutation of 32 bit lanes that moves the 64 bit lanes selected by a 4 bit mask to the front
+ */
+struct CompactTable
+{
+    constexpr CompactTable() : index()
+    {
+        for (int mask = 0; mask < 16; mask++)
+        {
+            int out = 0;
+            for (int lane = 0; lane < 4; lane++)
+            {
+                if (mask & (1 << lane))
+                {
+                    index[mask][2 * out] = 2 * lane;
+                    index[mask][2 * out + 1] = 2 * lane + 1;
+                    out++;
+                }
+            }
+            for (; out < 4; out++)
+            {
+                index[mask][2 * out] = 0;
+                index[mask][2 * out + 1] = 1;
+            }
+        }
+    }
+
+    alignas(32) int index[16][8];
+};
+
+constexpr CompactTable compact_table;
+
+__attribute__((target("avx2"))) FilterResult filter_avx2(std::int64_t* time, double* value,
+                                                         std::size_t size, std::int64_t frontier)
+{
+    FilterResult result;
+    std::size_t out = 0;
+    std::size_t i = 0;
+
+    const auto abs_mask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffff));
+    const auto inf = _mm256_set1_pd(INFINITY);
+    for (; i + 4 <= size; i += 4)
+    {
+        auto t = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(time + i));
+        auto v = _mm256_loadu_pd(value + i);
+
+        // fast path: the block starts after the last accepted value and is strictly increasing,
+        // so only NaN and Inf have to be removed
+        // the previous block may already be overwritten, so only compare within this one
+        auto t_prev = _mm256_permute4x64_epi64(t, _MM_SHUFFLE(2, 1, 0, 0));
+        int increasing = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(t, t_prev)));
+        if (time[i] <= frontier || (increasing & 0xe) != 0xe)
+        {
+            for (std::size_t j = i; j < i + 4; j++)
+            {
+                out = filter_one(time, value, j, out, frontier, result);
+            }
+            continue;
+        }
+
+        int nan = _mm256_movemask_pd(_mm256_cmp_pd(v, v, _CMP_UNORD_Q));
+        int infinite =
+            _mm256_movemask_pd(_mm256_cmp_pd(_mm256_and_pd(v, abs_mask), inf, _CMP_EQ_OQ));
+        int valid = ~(nan | infinite) & 0xf;
+        result.skip_nan += __builtin_popcount(nan);
+        result.skip_inf += __builtin_popcount(infinite);
+        if (valid == 0)
+        {
+            continue;
+        }
+
+        // we already loaded the whole block, so overwriting it in place is fine
+        auto permutation =
+            _mm256_load_si256(reinterpret_cast<const __m256i*>(compact_table.index[valid]));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(time + out),
+                            _mm256_permutevar8x32_epi32(t, permutation));
+        _mm256_storeu_pd(value + out, _mm256_castsi256_pd(_mm256_permutevar8x32_epi32(
+                                          _mm256_castpd_si256(v), permutation)));
+        out += __builtin_popcount(valid);
+        frontier = time[out - 1];
+    }
+
+    for (; i < size; i++)
+    {
+        out = filter_one(time, value, i, out, frontier, result);
+    }
+    result.accepted = out;
+    return result;
+}
+#endif
+} // namespace
+
+FilterResult filter_values(std::int64_t* time, double* value, std::size_t size,
+                           std::int64_t frontier)
+{
+#ifdef DB_HTA_FILTER_AVX2
+    static const bool use_avx2 = __builtin_cpu_supports("avx2");
+    if (use_avx2)
+    {
+        return filter_avx2(time, value, size, frontier);
+    }
+#endif
+    return filter_scalar(time, value, size, frontier);
+}
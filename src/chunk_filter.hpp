@@ -0,0 +1,45 @@
+// metricq-db-hta
+// Copyright (C) 2021 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-db-hta.
+//
+// metricq-db-hta is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-db-hta is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-db-hta.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+struct FilterResult
+{
+    // number of values that can be inserted, they are compacted to the front of the arrays
+    std::size_t accepted = 0;
+    std::uint64_t skip_non_monotonic = 0;
+    std::uint64_t skip_nan = 0;
+    std::uint64_t skip_inf = 0;
+};
+
+/**
+ * Removes all values that cannot be inserted into a metric, i.e. values that are NaN or +/-Inf
+ * and values whose timestamp is not strictly greater than the previously accepted one.
+ * The remaining values are moved to the front of the arrays, preserving their order.
+ *
+ * Uses AVX2 if the CPU supports it, chosen at runtime.
+ *
+ * @param time timestamps in nanoseconds
+ * @param frontier timestamp of the last value already in the metric
+ */
+FilterResult filter_values(std::int64_t* time, double* value, std::size_t size,
+                           std::int64_t frontier);
@@ -28,9 +28,16 @@
 #include <chrono>
 #include <ratio>
 
-Db::Db(const std::string& manager_host, const std::string& token)
+Db::Db(const std::string& manager_host, const std::string& token,
+       const std::string& capture_path)
 : metricq::Db(token), signals_(io_service, SIGINT, SIGTERM), stats_timer_(io_service)
 {
+    if (!capture_path.empty())
+    {
+        Log::info() << "Capturing all requests to " << capture_path;
+        capture_ = std::make_unique<CaptureWriter>(capture_path);
+    }
+
     signals_.async_wait([this](auto, auto signal) {
         if (!signal)
         {
@@ -60,6 +67,10 @@ void Db::on_closed()
 void Db::on_db_config(const metricq::json& config, metricq::Db::ConfigCompletion complete)
 {
     Log::debug() << "on_db_config";
+    if (capture_)
+    {
+        capture_->config(config);
+    }
     if (config.count("stats"))
     {
         auto stats = config.at("stats");
@@ -80,7 +91,7 @@ void Db::on_db_config(const metricq::json& config, metricq::Db::ConfigCompletion
             << std::chrono::duration_cast<std::chrono::duration<double>>(stats_interval).count()
             << " s.";
 
-        async_hta.stats().init(*this, prefix, rate);
+        async_hta.stats().init(*this, prefix, rate, stats);
         declare_metrics();
         if (stats_timer_.running())
         {
@@ -90,10 +101,10 @@ void Db::on_db_config(const metricq::json& config, metricq::Db::ConfigCompletion
         else
         {
             // Collect empty stats right at the beginning
-            async_hta.stats().collect();
+            async_hta.collect_stats();
             stats_timer_.start(
                 [this](auto) {
-                    async_hta.stats().collect();
+                    async_hta.collect_stats();
                     return metricq::Timer::TimerResult::repeat;
                 },
                 stats_interval);
@@ -117,6 +128,10 @@ void Db::on_data(const std::string& metric_name, const metricq::DataChunk& chunk
                  metricq::Db::DataCompletion complete)
 {
     Log::trace() << "data_callback with " << chunk.value_size() << " values";
+    if (capture_)
+    {
+        capture_->data(metric_name, chunk);
+    }
 
     async_hta.async_write(metric_name, chunk, std::move(complete));
 }
@@ -124,5 +139,9 @@ void Db::on_data(const std::string& metric_name, const metricq::DataChunk& chunk
 void Db::on_history(const std::string& id, const metricq::HistoryRequest& content,
                     metricq::Db::HistoryCompletion complete)
 {
+    if (capture_)
+    {
+        capture_->history(id, content);
+    }
     async_hta.async_read(id, content, std::move(complete));
 }
@@ -20,6 +20,7 @@
 #pragma once
 
 #include "async_hta_service.hpp"
+#include "capture.hpp"
 #include "db_stats.hpp"
 
 #include <metricq/db.hpp>
@@ -36,7 +37,8 @@
 class Db : public metricq::Db
 {
 public:
-    Db(const std::string& manager_host, const std::string& token = "metricq-db-hta");
+    Db(const std::string& manager_host, const std::string& token = "metricq-db-hta",
+       const std::string& capture_path = "");
 
 protected:
     void on_db_config(const metricq::json& config, metricq::Db::ConfigCompletion complete) override;
@@ -58,4 +60,6 @@ private:
     AsyncHtaService async_hta;
     asio::signal_set signals_;
     metricq::Timer stats_timer_;
+    // records all incoming requests if enabled
+    std::unique_ptr<CaptureWriter> capture_;
 };
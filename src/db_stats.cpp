@@ -21,7 +21,9 @@
 #include "db_stats.hpp"
 
 #include "db.hpp"
+#include "latency_histogram.hpp"
 #include "log.hpp"
+#include "sharded_counters.hpp"
 
 #include <metricq/chrono.hpp>
 #include <metricq/metadata.hpp>
@@ -29,8 +31,13 @@
 
 #include <fmt/format.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
-#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 class StatsCollector
 {
@@ -42,37 +49,36 @@ public:
 public:
     void pending()
     {
-        std::lock_guard lock(stats_mutex_);
-        stats_.in_pending_state_++;
+        counters_.add(in_pending_state, 1);
     }
 
     template <typename T>
     void active(T pending_duration)
     {
-        std::lock_guard lock(stats_mutex_);
-        stats_.pending_duration_ += std::chrono::duration_cast<metricq::Duration>(pending_duration);
-        stats_.in_pending_state_--;
-        stats_.started_count_++;
-        stats_.in_active_state_++;
+        counters_.add(pending_duration_ns,
+                      std::chrono::duration_cast<metricq::Duration>(pending_duration).count());
+        counters_.add(in_pending_state, -1);
+        counters_.add(started_count, 1);
+        counters_.add(in_active_state, 1);
     }
 
     template <typename T>
     void complete(T active_duration, size_t data_size)
     {
-        std::lock_guard lock(stats_mutex_);
-        stats_.completed_count_++;
-        stats_.in_active_state_--;
-        stats_.active_duration_ += std::chrono::duration_cast<metricq::Duration>(active_duration);
-        stats_.data_size_ += data_size;
+        counters_.add(completed_count, 1);
+        counters_.add(in_active_state, -1);
+        counters_.add(active_duration_ns,
+                      std::chrono::duration_cast<metricq::Duration>(active_duration).count());
+        counters_.add(data_size_bytes, static_cast<std::int64_t>(data_size));
     }
 
     template <typename T>
     void failed(T active_duration)
     {
-        std::lock_guard lock(stats_mutex_);
-        stats_.in_active_state_--;
-        stats_.failed_count_++;
-        stats_.active_duration_ += std::chrono::duration_cast<metricq::Duration>(active_duration);
+        counters_.add(in_active_state, -1);
+        counters_.add(failed_count, 1);
+        counters_.add(active_duration_ns,
+                      std::chrono::duration_cast<metricq::Duration>(active_duration).count());
     }
 
     struct Stats
@@ -84,43 +90,199 @@ public:
         metricq::Duration pending_duration_ = metricq::Duration(0);
         metricq::Duration active_duration_ = metricq::Duration(0);
 
-        // number of requests in pending state, not affected by reset()
+        // number of requests in pending state, not reset by collect()
         size_t in_pending_state_ = 0;
 
-        // number of requests in active state, not affected by reset()
+        // number of requests in active state, not reset by collect()
         size_t in_active_state_ = 0;
-
-        void reset() noexcept
-        {
-            completed_count_ = 0;
-            failed_count_ = 0;
-            started_count_ = 0;
-            data_size_ = 0;
-            pending_duration_ = metricq::Duration(0);
-            active_duration_ = metricq::Duration(0);
-        }
     };
 
+    /**
+     * The counters are read one after another without stopping concurrent updates, so they
+     * may be slightly inconsistent with each other, but no update is lost.
+     */
     Stats collect()
     {
-        std::lock_guard lock(stats_mutex_);
-        Stats collected_stats = stats_;
-        stats_.reset();
-        return collected_stats;
+        Stats stats;
+        stats.completed_count_ = counters_.exchange(completed_count);
+        stats.failed_count_ = counters_.exchange(failed_count);
+        stats.started_count_ = counters_.exchange(started_count);
+        stats.data_size_ = counters_.exchange(data_size_bytes);
+        stats.pending_duration_ = metricq::Duration(counters_.exchange(pending_duration_ns));
+        stats.active_duration_ = metricq::Duration(counters_.exchange(active_duration_ns));
+        // a request may be counted as active before it is seen as no longer pending
+        stats.in_pending_state_ = std::max<std::int64_t>(0, counters_.load(in_pending_state));
+        stats.in_active_state_ = std::max<std::int64_t>(0, counters_.load(in_active_state));
+        return stats;
     }
 
 private:
-    std::mutex stats_mutex_;
-    Stats stats_;
+    enum Counter : std::size_t
+    {
+        completed_count,
+        failed_count,
+        started_count,
+        data_size_bytes,
+        pending_duration_ns,
+        active_duration_ns,
+        in_pending_state,
+        in_active_state,
+        counter_count,
+    };
+
+    ShardedCounters<counter_count> counters_;
 };
 
 using Metric = metricq::Metric<metricq::Db>;
 
+static const char* name(RequestKind kind)
+{
+    switch (kind)
+    {
+    case RequestKind::write:
+        return "write";
+    case RequestKind::aggregate_timeline:
+        return "aggregate_timeline";
+    case RequestKind::aggregate:
+        return "aggregate";
+    case RequestKind::last_value:
+        return "last_value";
+    case RequestKind::flex_timeline:
+        return "flex_timeline";
+    }
+    return "unknown";
+}
+
+struct LatencyConfig
+{
+    LatencyConfig(const metricq::json& config)
+    {
+        if (!config.count("latency"))
+        {
+            return;
+        }
+        const auto& latency = config.at("latency");
+        auto to_ns = [](double seconds) {
+            return std::chrono::duration_cast<metricq::Duration>(
+                       std::chrono::duration<double>(seconds))
+                .count();
+        };
+        min = to_ns(latency.value("min", 1e-6));
+        max = to_ns(latency.value("max", 100.0));
+        quantiles = latency.value("quantiles", quantiles);
+        if (min <= 0 || max < min)
+        {
+            throw std::runtime_error("invalid latency histogram range configured for stats");
+        }
+        for (auto quantile : quantiles)
+        {
+            if (quantile <= 0 || quantile > 1)
+            {
+                throw std::runtime_error("invalid latency quantile configured for stats");
+            }
+        }
+    }
+
+    // range of the histograms in ns
+    std::int64_t min = 1'000;
+    std::int64_t max = 100'000'000'000;
+    std::vector<double> quantiles = { 0.5, 0.99, 0.999 };
+};
+
+struct LatencyHistograms
+{
+    LatencyHistograms(const LatencyConfig& config)
+    : pending(config.min, config.max), active(config.min, config.max)
+    {
+    }
+
+    /**
+     * @return histograms for each RequestKind
+     */
+    static std::vector<LatencyHistograms> make(const LatencyConfig& config)
+    {
+        std::vector<LatencyHistograms> histograms;
+        histograms.reserve(request_kind_count);
+        for (std::size_t i = 0; i < request_kind_count; i++)
+        {
+            histograms.emplace_back(config);
+        }
+        return histograms;
+    }
+
+    LatencyHistogram pending;
+    LatencyHistogram active;
+};
+
+/**
+ * Quantiles of the pending and active time of one kind of requests
+ */
+class LatencyMetrics
+{
+public:
+    LatencyMetrics(RequestKind kind, LatencyHistograms& histograms, Db& writer,
+                   const std::string& prefix, const LatencyConfig& config, double rate)
+    : histograms_(histograms)
+    {
+        // e.g. read.aggregate_timeline.pending.time.p99_9
+        auto base = kind == RequestKind::write ? prefix + "write" :
+                                                 fmt::format("{}read.{}", prefix, name(kind));
+        for (auto quantile : config.quantiles)
+        {
+            auto suffix = fmt::format("p{:g}", quantile * 100);
+            std::replace(suffix.begin(), suffix.end(), '.', '_');
+            pending_.push_back(
+                { quantile, &writer.output_metric(base + ".pending.time." + suffix) });
+            active_.push_back({ quantile, &writer.output_metric(base + ".active.time." + suffix) });
+            for (auto [state, metric] : { std::make_pair("pending", pending_.back().metric),
+                                          std::make_pair("active", active_.back().metric) })
+            {
+                metric->metadata.unit("s");
+                metric->metadata.quantity("time");
+                metric->metadata.description(fmt::format(
+                    "{} quantile of the time {} requests were {}", suffix, name(kind), state));
+                metric->metadata.scope(metricq::Metadata::Scope::last);
+                metric->metadata.rate(rate);
+            }
+        }
+    }
+
+    void write(metricq::TimePoint time)
+    {
+        send(histograms_.pending.collect(), pending_, time);
+        send(histograms_.active.collect(), active_, time);
+    }
+
+private:
+    struct Quantile
+    {
+        double quantile;
+        Metric* metric;
+    };
+
+    static void send(const LatencyHistogram::Snapshot& snapshot,
+                     const std::vector<Quantile>& quantiles, metricq::TimePoint time)
+    {
+        for (const auto& quantile : quantiles)
+        {
+            auto value = std::chrono::duration_cast<std::chrono::duration<double>>(
+                             metricq::Duration(snapshot.quantile(quantile.quantile)))
+                             .count();
+            quantile.metric->send({ time, value });
+        }
+    }
+
+    LatencyHistograms& histograms_;
+    std::vector<Quantile> pending_;
+    std::vector<Quantile> active_;
+};
+
 class StatsMetrics
 {
 public:
     StatsMetrics(const std::string& read_or_write, Db& writer, const std::string& prefix,
-                 double rate)
+                 double rate, const std::vector<RequestKind>& kinds,
+                 std::vector<LatencyHistograms>& histograms, const LatencyConfig& latency)
     : request_rate_(writer.output_metric(prefix + read_or_write + ".request.rate")),
       data_rate_(writer.output_metric(prefix + read_or_write + ".data.rate")),
       pending_time_(writer.output_metric(prefix + read_or_write + ".pending.time")),
@@ -176,6 +338,12 @@ public:
             fmt::format("number of failed {}-requests", read_or_write));
         failed_count_.metadata.scope(metricq::Metadata::Scope::last);
         failed_count_.metadata.rate(rate);
+
+        for (auto kind : kinds)
+        {
+            latency_.emplace_back(kind, histograms.at(static_cast<std::size_t>(kind)), writer,
+                                  prefix, latency, rate);
+        }
     }
 
     void write(StatsCollector::Stats stats, metricq::TimePoint time, double duration)
@@ -203,6 +371,10 @@ public:
         pending_count_.send({ time, static_cast<double>(stats.in_pending_state_) });
         active_count_.send({ time, static_cast<double>(stats.in_active_state_) });
         failed_count_.send({ time, static_cast<double>(stats.failed_count_) });
+        for (auto& latency : latency_)
+        {
+            latency.write(time);
+        }
     }
 
 private:
@@ -213,14 +385,316 @@ private:
     Metric& pending_count_;
     Metric& active_count_;
     Metric& failed_count_;
+    std::vector<LatencyMetrics> latency_;
+};
+
+class CacheStatsMetrics
+{
+public:
+    CacheStatsMetrics(Db& writer, const std::string& prefix, double rate)
+    : hit_count_(writer.output_metric(prefix + "cache.hit.count")),
+      miss_count_(writer.output_metric(prefix + "cache.miss.count")),
+      evict_count_(writer.output_metric(prefix + "cache.evict.count")),
+      size_(writer.output_metric(prefix + "cache.size"))
+    {
+        hit_count_.metadata.unit("");
+        hit_count_.metadata.quantity("");
+        hit_count_.metadata.description("number of history requests answered from the cache");
+        hit_count_.metadata.scope(metricq::Metadata::Scope::last);
+        hit_count_.metadata.rate(rate);
+
+        miss_count_.metadata.unit("");
+        miss_count_.metadata.quantity("");
+        miss_count_.metadata.description("number of cacheable history requests not in the cache");
+        miss_count_.metadata.scope(metricq::Metadata::Scope::last);
+        miss_count_.metadata.rate(rate);
+
+        evict_count_.metadata.unit("");
+        evict_count_.metadata.quantity("");
+        evict_count_.metadata.description(
+            "number of responses evicted from the cache or invalidated by writes");
+        evict_count_.metadata.scope(metricq::Metadata::Scope::last);
+        evict_count_.metadata.rate(rate);
+
+        size_.metadata.unit("B");
+        size_.metadata.quantity("size");
+        size_.metadata.description("memory used by cached history responses");
+        size_.metadata.scope(metricq::Metadata::Scope::point);
+        size_.metadata.rate(rate);
+    }
+
+    void write(metricq::TimePoint time)
+    {
+        hit_count_.send({ time, static_cast<double>(hits.exchange(0)) });
+        miss_count_.send({ time, static_cast<double>(misses.exchange(0)) });
+        evict_count_.send({ time, static_cast<double>(evictions.exchange(0)) });
+        size_.send({ time, static_cast<double>(size.load()) });
+    }
+
+    std::atomic<size_t> hits{ 0 };
+    std::atomic<size_t> misses{ 0 };
+    std::atomic<size_t> evictions{ 0 };
+    std::atomic<size_t> size{ 0 };
+
+private:
+    Metric& hit_count_;
+    Metric& miss_count_;
+    Metric& evict_count_;
+    Metric& size_;
+};
+
+class AdmissionStatsMetrics
+{
+public:
+    AdmissionStatsMetrics(Db& writer, const std::string& prefix, double rate)
+    : pending_bytes_(writer.output_metric(prefix + "write.pending.bytes")),
+      throttled_count_(writer.output_metric(prefix + "write.throttled.count"))
+    {
+        pending_bytes_.metadata.unit("B");
+        pending_bytes_.metadata.quantity("size");
+        pending_bytes_.metadata.description("data of received chunks that are not yet written");
+        pending_bytes_.metadata.scope(metricq::Metadata::Scope::point);
+        pending_bytes_.metadata.rate(rate);
+
+        throttled_count_.metadata.unit("");
+        throttled_count_.metadata.quantity("");
+        throttled_count_.metadata.description(
+            "number of write completions held back due to the admission limits");
+        throttled_count_.metadata.scope(metricq::Metadata::Scope::last);
+        throttled_count_.metadata.rate(rate);
+    }
+
+    void write(metricq::TimePoint time)
+    {
+        pending_bytes_.send({ time, static_cast<double>(pending_bytes.load()) });
+        throttled_count_.send({ time, static_cast<double>(throttled.exchange(0)) });
+    }
+
+    std::atomic<size_t> pending_bytes{ 0 };
+    std::atomic<size_t> throttled{ 0 };
+
+private:
+    Metric& pending_bytes_;
+    Metric& throttled_count_;
+};
+
+class OverlapStatsMetrics
+{
+public:
+    OverlapStatsMetrics(Db& writer, const std::string& prefix, double rate)
+    : overlap_count_(writer.output_metric(prefix + "read.overlap.count"))
+    {
+        overlap_count_.metadata.unit("");
+        overlap_count_.metadata.quantity("");
+        overlap_count_.metadata.description(
+            "number of read-requests processed concurrently to a write of the same metric");
+        overlap_count_.metadata.scope(metricq::Metadata::Scope::last);
+        overlap_count_.metadata.rate(rate);
+    }
+
+    void write(metricq::TimePoint time)
+    {
+        overlap_count_.send({ time, static_cast<double>(overlaps.exchange(0)) });
+    }
+
+    std::atomic<size_t> overlaps{ 0 };
+
+private:
+    Metric& overlap_count_;
+};
+
+class CoalesceStatsMetrics
+{
+public:
+    CoalesceStatsMetrics(Db& writer, const std::string& prefix, double rate)
+    : coalesced_count_(writer.output_metric(prefix + "read.coalesced.count"))
+    {
+        coalesced_count_.metadata.unit("");
+        coalesced_count_.metadata.quantity("");
+        coalesced_count_.metadata.description(
+            "number of read-requests answered by an identical request already in flight");
+        coalesced_count_.metadata.scope(metricq::Metadata::Scope::last);
+        coalesced_count_.metadata.rate(rate);
+    }
+
+    void write(metricq::TimePoint time)
+    {
+        coalesced_count_.send({ time, static_cast<double>(coalesced.exchange(0)) });
+    }
+
+    std::atomic<size_t> coalesced{ 0 };
+
+private:
+    Metric& coalesced_count_;
+};
+
+class QueueStatsMetrics
+{
+public:
+    QueueStatsMetrics(WorkClass work_class, Db& writer, const std::string& prefix, double rate)
+    : depth_(writer.output_metric(fmt::format("{}queue.{}.depth", prefix, name(work_class)))),
+      wait_time_(
+          writer.output_metric(fmt::format("{}queue.{}.wait.time", prefix, name(work_class)))),
+      expired_count_(
+          writer.output_metric(fmt::format("{}queue.{}.expired.count", prefix, name(work_class))))
+    {
+        depth_.metadata.unit("");
+        depth_.metadata.quantity("");
+        depth_.metadata.description(
+            fmt::format("number of queued {} requests not yet started", name(work_class)));
+        depth_.metadata.scope(metricq::Metadata::Scope::point);
+        depth_.metadata.rate(rate);
+
+        wait_time_.metadata.unit("s");
+        wait_time_.metadata.quantity("time");
+        wait_time_.metadata.description(fmt::format(
+            "average time {} requests waited in the scheduler queue", name(work_class)));
+        wait_time_.metadata.scope(metricq::Metadata::Scope::last);
+        wait_time_.metadata.rate(rate);
+
+        expired_count_.metadata.unit("");
+        expired_count_.metadata.quantity("");
+        expired_count_.metadata.description(fmt::format(
+            "number of {} requests that failed due to their deadline", name(work_class)));
+        expired_count_.metadata.scope(metricq::Metadata::Scope::last);
+        expired_count_.metadata.rate(rate);
+    }
+
+    void write(metricq::TimePoint time)
+    {
+        depth_.send({ time, static_cast<double>(depth.load()) });
+        auto count = waited.exchange(0);
+        auto wait_duration = metricq::Duration(wait_ns.exchange(0));
+        double wait_time = 0;
+        if (count > 0)
+        {
+            wait_time =
+                std::chrono::duration_cast<std::chrono::duration<double>>(wait_duration).count() /
+                count;
+        }
+        wait_time_.send({ time, wait_time });
+        expired_count_.send({ time, static_cast<double>(expired.exchange(0)) });
+    }
+
+    std::atomic<size_t> depth{ 0 };
+    std::atomic<size_t> waited{ 0 };
+    std::atomic<metricq::Duration::rep> wait_ns{ 0 };
+    std::atomic<size_t> expired{ 0 };
+
+private:
+    Metric& depth_;
+    Metric& wait_time_;
+    Metric& expired_count_;
+};
+
+/**
+ * Keeps the metrics with the highest cost, i.e. the most active time, within one stats interval
+ * and logs them as JSON at the end of the interval.
+ */
+class HotSpots
+{
+public:
+    explicit HotSpots(const metricq::json& config)
+    {
+        auto count = config.value("hot_spots", 0);
+        if (count < 0)
+        {
+            throw std::runtime_error("invalid number of hot spots configured for stats");
+        }
+        count_ = count;
+        top_.reserve(count_);
+    }
+
+    bool enabled() const
+    {
+        return count_ > 0;
+    }
+
+    void add(const std::string& metric, const MetricActivity& activity)
+    {
+        if (!enabled() || activity.cost().count() == 0)
+        {
+            return;
+        }
+        // top_ is a min-heap, so the cheapest of the current top metrics is replaced
+        if (top_.size() < count_)
+        {
+            top_.push_back({ metric, activity });
+            std::push_heap(top_.begin(), top_.end(), more_expensive);
+        }
+        else if (activity.cost() > top_.front().activity.cost())
+        {
+            std::pop_heap(top_.begin(), top_.end(), more_expensive);
+            top_.back() = { metric, activity };
+            std::push_heap(top_.begin(), top_.end(), more_expensive);
+        }
+    }
+
+    void write(double duration)
+    {
+        if (top_.empty())
+        {
+            return;
+        }
+        // most expensive first
+        std::sort_heap(top_.begin(), top_.end(), more_expensive);
+        auto seconds = [](metricq::Duration duration) {
+            return std::chrono::duration_cast<std::chrono::duration<double>>(duration).count();
+        };
+        auto metrics = metricq::json::array();
+        for (const auto& [metric, activity] : top_)
+        {
+            metrics.push_back({ { "metric", metric },
+                                { "utilization", seconds(activity.cost()) / duration },
+                                { "write_chunks", activity.write_chunks },
+                                { "write_values", activity.write_values },
+                                { "write_bytes", activity.write_bytes },
+                                { "write_active", seconds(activity.write_active) },
+                                { "skip_non_monotonic", activity.skip_non_monotonic },
+                                { "skip_nan", activity.skip_nan },
+                                { "skip_inf", activity.skip_inf },
+                                { "read_requests", activity.read_requests },
+                                { "read_active", seconds(activity.read_active) } });
+        }
+        Log::info() << "hot spots: " << metricq::json{ { "interval", duration },
+                                                         { "metrics", metrics } }
+                                            .dump();
+        top_.clear();
+    }
+
+private:
+    struct Entry
+    {
+        std::string metric;
+        MetricActivity activity;
+    };
+
+    static bool more_expensive(const Entry& a, const Entry& b)
+    {
+        return a.activity.cost() > b.activity.cost();
+    }
+
+    std::size_t count_ = 0;
+    std::vector<Entry> top_;
 };
 
 class DbStats::DbStatsImpl
 {
 public:
-    DbStatsImpl(Db& db, const std::string& prefix, double rate)
-    : previous_collect_time_(metricq::Clock::now()), read_metrics_("read", db, prefix, rate),
-      write_metrics_("write", db, prefix, rate)
+    DbStatsImpl(Db& db, const std::string& prefix, double rate, const metricq::json& config,
+                const LatencyConfig& latency_config)
+    : latency(LatencyHistograms::make(latency_config)), hot_spots(config),
+      cache(db, prefix, rate), admission(db, prefix, rate), overlap(db, prefix, rate),
+      coalesce(db, prefix, rate),
+      queues{ QueueStatsMetrics(WorkClass::interactive_read, db, prefix, rate),
+              QueueStatsMetrics(WorkClass::bulk_read, db, prefix, rate),
+              QueueStatsMetrics(WorkClass::write, db, prefix, rate) },
+      previous_collect_time_(metricq::Clock::now()),
+      read_metrics_("read", db, prefix, rate,
+                    { RequestKind::aggregate_timeline, RequestKind::aggregate,
+                      RequestKind::last_value, RequestKind::flex_timeline },
+                    latency, latency_config),
+      write_metrics_("write", db, prefix, rate, { RequestKind::write }, latency, latency_config)
     {
     }
 
@@ -235,11 +709,28 @@ public:
         auto write_stats = write.collect();
         read_metrics_.write(read_stats, time, duration);
         write_metrics_.write(write_stats, time, duration);
+        hot_spots.write(duration);
+        cache.write(time);
+        admission.write(time);
+        overlap.write(time);
+        coalesce.write(time);
+        for (auto& queue : queues)
+        {
+            queue.write(time);
+        }
         previous_collect_time_ = time;
     }
 
+    // one per RequestKind
+    std::vector<LatencyHistograms> latency;
+    HotSpots hot_spots;
     StatsCollector read;
     StatsCollector write;
+    CacheStatsMetrics cache;
+    AdmissionStatsMetrics admission;
+    OverlapStatsMetrics overlap;
+    CoalesceStatsMetrics coalesce;
+    std::array<QueueStatsMetrics, work_class_count> queues;
 
 private:
     metricq::TimePoint previous_collect_time_;
@@ -255,7 +746,7 @@ DbStats::~DbStats()
 {
 }
 
-void DbStats::init(Db& db, const std::string& prefix, double rate)
+void DbStats::init(Db& db, const std::string& prefix, double rate, const metricq::json& config)
 {
     if (impl)
     {
@@ -264,7 +755,7 @@ void DbStats::init(Db& db, const std::string& prefix, double rate)
                        "restart.";
         return;
     }
-    impl = std::make_unique<DbStatsImpl>(db, prefix, rate);
+    impl = std::make_unique<DbStatsImpl>(db, prefix, rate, config, LatencyConfig(config));
 }
 
 void DbStats::read_pending()
@@ -299,6 +790,22 @@ void DbStats::read_failed(metricq::Duration active_duration)
     }
 }
 
+void DbStats::pending_latency(RequestKind kind, metricq::Duration pending_duration)
+{
+    if (impl)
+    {
+        impl->latency[static_cast<std::size_t>(kind)].pending.record(pending_duration.count());
+    }
+}
+
+void DbStats::active_latency(RequestKind kind, metricq::Duration active_duration)
+{
+    if (impl)
+    {
+        impl->latency[static_cast<std::size_t>(kind)].active.record(active_duration.count());
+    }
+}
+
 void DbStats::write_pending()
 {
     if (impl)
@@ -331,6 +838,110 @@ void DbStats::write_failed(metricq::Duration active_duration)
     }
 }
 
+void DbStats::write_pending_bytes(std::size_t bytes)
+{
+    if (impl)
+    {
+        impl->admission.pending_bytes.store(bytes, std::memory_order_relaxed);
+    }
+}
+
+void DbStats::write_throttled()
+{
+    if (impl)
+    {
+        impl->admission.throttled++;
+    }
+}
+
+void DbStats::read_overlap()
+{
+    if (impl)
+    {
+        impl->overlap.overlaps++;
+    }
+}
+
+void DbStats::read_coalesced()
+{
+    if (impl)
+    {
+        impl->coalesce.coalesced++;
+    }
+}
+
+void DbStats::queue_push(WorkClass work_class)
+{
+    if (impl)
+    {
+        impl->queues[index(work_class)].depth++;
+    }
+}
+
+void DbStats::queue_pop(WorkClass work_class, metricq::Duration wait_duration)
+{
+    if (impl)
+    {
+        auto& queue = impl->queues[index(work_class)];
+        queue.depth--;
+        queue.waited++;
+        queue.wait_ns += wait_duration.count();
+    }
+}
+
+void DbStats::queue_expired(WorkClass work_class)
+{
+    if (impl)
+    {
+        impl->queues[index(work_class)].expired++;
+    }
+}
+
+void DbStats::cache_hit()
+{
+    if (impl)
+    {
+        impl->cache.hits++;
+    }
+}
+
+void DbStats::cache_miss()
+{
+    if (impl)
+    {
+        impl->cache.misses++;
+    }
+}
+
+void DbStats::cache_evict(std::size_t count)
+{
+    if (impl)
+    {
+        impl->cache.evictions += count;
+    }
+}
+
+void DbStats::cache_size(std::size_t bytes)
+{
+    if (impl)
+    {
+        impl->cache.size = bytes;
+    }
+}
+
+bool DbStats::hot_spots_enabled() const
+{
+    return impl && impl->hot_spots.enabled();
+}
+
+void DbStats::metric_activity(const std::string& metric, const MetricActivity& activity)
+{
+    if (impl)
+    {
+        impl->hot_spots.add(metric, activity);
+    }
+}
+
 void DbStats::collect()
 {
     if (impl)
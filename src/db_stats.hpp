@@ -19,14 +19,53 @@
 // along with metricq-db-hta.  If not, see <http://www.gnu.org/licenses/>.
 #pragma once
 
+#include "work_class.hpp"
+
 #include <metricq/chrono.hpp>
 #include <metricq/json.hpp>
 
 #include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <string>
 
 class Db;
 
+/**
+ * Request types with separate latency histograms
+ */
+enum class RequestKind
+{
+    write,
+    aggregate_timeline,
+    aggregate,
+    last_value,
+    flex_timeline,
+};
+
+constexpr std::size_t request_kind_count = 5;
+
+/**
+ * What a single metric did during one stats interval
+ */
+struct MetricActivity
+{
+    std::uint64_t write_chunks = 0;
+    std::uint64_t write_values = 0;
+    std::uint64_t write_bytes = 0;
+    std::uint64_t skip_non_monotonic = 0;
+    std::uint64_t skip_nan = 0;
+    std::uint64_t skip_inf = 0;
+    std::uint64_t read_requests = 0;
+    metricq::Duration write_active = metricq::Duration(0);
+    metricq::Duration read_active = metricq::Duration(0);
+
+    metricq::Duration cost() const
+    {
+        return write_active + read_active;
+    }
+};
+
 class DbStats
 {
 public:
@@ -34,7 +73,10 @@ public:
 
     ~DbStats();
 
-    void init(Db& db, const std::string& prefix, double rate);
+    /**
+     * @param config the stats section of the db config
+     */
+    void init(Db& db, const std::string& prefix, double rate, const metricq::json& config);
 
     void read_pending();
 
@@ -44,6 +86,14 @@ public:
 
     void read_failed(metricq::Duration active_duration);
 
+    void read_overlap();
+
+    void read_coalesced();
+
+    void pending_latency(RequestKind kind, metricq::Duration pending_duration);
+
+    void active_latency(RequestKind kind, metricq::Duration active_duration);
+
     void write_pending();
 
     void write_active(metricq::Duration pending_duration);
@@ -52,6 +102,35 @@ public:
 
     void write_failed(metricq::Duration active_duration);
 
+    void write_pending_bytes(std::size_t bytes);
+
+    void write_throttled();
+
+    void queue_push(WorkClass work_class);
+
+    void queue_pop(WorkClass work_class, metricq::Duration wait_duration);
+
+    void queue_expired(WorkClass work_class);
+
+    void cache_hit();
+
+    void cache_miss();
+
+    void cache_evict(std::size_t count);
+
+    void cache_size(std::size_t bytes);
+
+    /**
+     * @return true if the activity of individual metrics should be reported before collect()
+     */
+    bool hot_spots_enabled() const;
+
+    /**
+     * Report the activity of a metric since the last collect(), must be called from the thread
+     * that calls collect()
+     */
+    void metric_activity(const std::string& metric, const MetricActivity& activity);
+
     void collect();
 
 private:
@@ -60,15 +139,24 @@ private:
     std::unique_ptr<DbStatsImpl> impl;
 };
 
+/**
+ * Accounts the time spent active on one or more requests that are processed together.
+ * Each request must have been announced as pending before.
+ */
 template <void (DbStats::*active)(metricq::Duration), void (DbStats::*failed)(metricq::Duration),
           void (DbStats::*complete)(metricq::Duration, std::size_t)>
 class DbStatsTransaction
 {
 public:
-    DbStatsTransaction(DbStats& stats, metricq::TimePoint pending_since)
-    : begin_(metricq::Clock::now()), stats_(&stats)
+    DbStatsTransaction(DbStats& stats, RequestKind kind)
+    : begin_(metricq::Clock::now()), stats_(&stats), kind_(kind)
     {
-        (stats_->*active)(begin_ - pending_since);
+    }
+
+    DbStatsTransaction(DbStats& stats, metricq::TimePoint pending_since, RequestKind kind)
+    : DbStatsTransaction(stats, kind)
+    {
+        add(pending_since);
     }
 
     DbStatsTransaction(const DbStatsTransaction&) = delete;
@@ -77,24 +165,49 @@ public:
 
     ~DbStatsTransaction()
     {
-        if (!success_)
+        if (!success_ && count_ > 0)
         {
-            (stats_->*failed)(metricq::Clock::now() - begin_);
+            auto duration = metricq::Clock::now() - begin_;
+            for (std::size_t i = 0; i < count_; i++)
+            {
+                (stats_->*failed)(share(duration));
+                stats_->active_latency(kind_, duration);
+            }
         }
     }
 
+    void add(metricq::TimePoint pending_since)
+    {
+        (stats_->*active)(begin_ - pending_since);
+        stats_->pending_latency(kind_, begin_ - pending_since);
+        count_++;
+    }
+
     metricq::Duration completed(std::size_t data_size)
     {
         auto duration = metricq::Clock::now() - begin_;
-        (stats_->*complete)(duration, data_size);
+        // split the active time evenly so that the utilization is not overestimated, but each
+        // request waited for the whole pass
+        for (std::size_t i = 0; i < count_; i++)
+        {
+            (stats_->*complete)(share(duration), i == 0 ? data_size : 0);
+            stats_->active_latency(kind_, duration);
+        }
         success_ = true;
 
         return duration;
     }
 
 private:
+    metricq::Duration share(metricq::Duration duration) const
+    {
+        return duration / static_cast<metricq::Duration::rep>(count_);
+    }
+
     metricq::TimePoint begin_;
     DbStats* stats_;
+    RequestKind kind_;
+    std::size_t count_ = 0;
     bool success_ = false;
 };
 
@@ -0,0 +1,157 @@
+// metricq-db-hta
+// Copyright (C) 2021 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-db-hta.
+//
+// metricq-db-hta is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-db-hta is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-db-hta.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * Lock-free histogram of durations with log-linear buckets like HdrHistogram. Each power of two
+ * is split into 2^(precision_bits - 1) linear buckets, bounding the relative error of the
+ * reported quantiles by 2^(1 - precision_bits). Values outside of [min, max] are clamped.
+ */
+class LatencyHistogram
+{
+public:
+    static constexpr unsigned precision_bits = 7;
+
+    /**
+     * @param min smallest distinguishable value in ns, must be > 0
+     * @param max largest value in ns
+     */
+    LatencyHistogram(std::int64_t min, std::int64_t max)
+    : min_(min), max_(max), size_(index(max) + 1), counts_(new std::atomic<std::uint64_t>[size_])
+    {
+        assert(min_ > 0 && max_ >= min_);
+        for (std::size_t i = 0; i < size_; i++)
+        {
+            counts_[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void record(std::int64_t value)
+    {
+        counts_[index(value)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * Counts recorded since the last collect() that quantiles can be computed from
+     */
+    class Snapshot
+    {
+    public:
+        /**
+         * @return the value in ns at the given quantile, 0 if nothing was recorded
+         */
+        std::int64_t quantile(double q) const
+        {
+            if (total_ == 0)
+            {
+                return 0;
+            }
+            auto rank = std::max<std::uint64_t>(1, std::ceil(q * total_));
+            std::uint64_t seen = 0;
+            for (std::size_t i = 0; i < counts_.size(); i++)
+            {
+                seen += counts_[i];
+                if (seen >= rank)
+                {
+                    return histogram_.value(i);
+                }
+            }
+            return histogram_.value(counts_.size() - 1);
+        }
+
+        std::uint64_t total() const
+        {
+            return total_;
+        }
+
+    private:
+        friend class LatencyHistogram;
+
+        explicit Snapshot(const LatencyHistogram& histogram) : histogram_(histogram)
+        {
+        }
+
+        const LatencyHistogram& histogram_;
+        std::vector<std::uint64_t> counts_;
+        std::uint64_t total_ = 0;
+    };
+
+    /**
+     * Take the counts since the last call and reset them. Concurrent record() calls end up in
+     * either this or the next snapshot.
+     */
+    Snapshot collect()
+    {
+        Snapshot snapshot(*this);
+        snapshot.counts_.resize(size_);
+        for (std::size_t i = 0; i < size_; i++)
+        {
+            snapshot.counts_[i] = counts_[i].exchange(0, std::memory_order_relaxed);
+            snapshot.total_ += snapshot.counts_[i];
+        }
+        return snapshot;
+    }
+
+private:
+    static constexpr std::uint64_t linear_buckets = std::uint64_t(1) << precision_bits;
+    static constexpr std::uint64_t half_buckets = linear_buckets / 2;
+
+    std::size_t index(std::int64_t value) const
+    {
+        auto scaled = static_cast<std::uint64_t>(std::clamp(value, min_, max_) / min_);
+        if (scaled < linear_buckets)
+        {
+            return scaled;
+        }
+        // scaled >> shift is in [half_buckets, linear_buckets)
+        unsigned shift = 63 - __builtin_clzll(scaled) - (precision_bits - 1);
+        auto mantissa = scaled >> shift;
+        return linear_buckets + (shift - 1) * half_buckets + (mantissa - half_buckets);
+    }
+
+    /**
+     * @return the middle of the range of values counted in the bucket
+     */
+    std::int64_t value(std::size_t index) const
+    {
+        if (index < linear_buckets)
+        {
+            return static_cast<std::int64_t>(index) * min_ + min_ / 2;
+        }
+        auto shift = (index - linear_buckets) / half_buckets + 1;
+        auto mantissa = (index - linear_buckets) % half_buckets + half_buckets;
+        auto scaled = (mantissa << shift) + (std::uint64_t(1) << shift) / 2;
+        return static_cast<std::int64_t>(scaled) * min_;
+    }
+
+    std::int64_t min_;
+    std::int64_t max_;
+    std::size_t size_;
+    std::unique_ptr<std::atomic<std::uint64_t>[]> counts_;
+};
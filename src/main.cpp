@@ -34,6 +34,8 @@ int main(int argc, char* argv[])
         .short_name("s");
     parser.option("token", "The token used for source authentication against the metricq manager.")
         .default_value("db-hta");
+    parser.option("capture", "Record all incoming requests to this file for a later replay.")
+        .default_value("");
     parser.toggle("trace").short_name("t");
     parser.toggle("verbose").short_name("v");
     parser.toggle("quiet").short_name("q");
@@ -63,7 +65,7 @@ int main(int argc, char* argv[])
         }
 
         metricq::logger::nitro::initialize();
-        Db db(options.get("server"), options.get("token"));
+        Db db(options.get("server"), options.get("token"), options.get("capture"));
         db.main_loop();
         Log::info() << "exiting main loop.";
     }
@@ -0,0 +1,463 @@
+// metricq-db-hta
+// Copyright (C) 2021 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-db-hta.
+//
+// metricq-db-hta is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-db-hta is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-db-hta.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include "db_stats.hpp"
+#include "row_estimate.hpp"
+#include "worker_pool.hpp"
+#include "write_queue.hpp"
+
+#include <hta/directory.hpp>
+#include <hta/hta.hpp>
+
+#include <metricq/json.hpp>
+
+#include <asio.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * Last value of a metric that can be read from any thread without locking.
+ * There must only be a single writer at a time, i.e. the metric's strand.
+ */
+class LastValue
+{
+public:
+    enum class State
+    {
+        // not yet read from storage
+        unknown,
+        // the metric has no values
+        empty,
+        known,
+    };
+
+    void store(hta::TimeValue tv)
+    {
+        // sequence lock, odd while writing
+        auto seq = seq_.load(std::memory_order_relaxed);
+        seq_.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        time_.store(tv.time.time_since_epoch().count(), std::memory_order_relaxed);
+        value_.store(tv.value, std::memory_order_relaxed);
+        seq_.store(seq + 2, std::memory_order_release);
+        state_.store(State::known, std::memory_order_release);
+    }
+
+    void store_empty()
+    {
+        state_.store(State::empty, std::memory_order_release);
+    }
+
+    State load(hta::TimeValue& tv) const
+    {
+        auto state = state_.load(std::memory_order_acquire);
+        if (state != State::known)
+        {
+            return state;
+        }
+        while (true)
+        {
+            auto seq = seq_.load(std::memory_order_acquire);
+            if (seq & 1)
+            {
+                continue;
+            }
+            auto time = time_.load(std::memory_order_relaxed);
+            auto value = value_.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq_.load(std::memory_order_relaxed) == seq)
+            {
+                tv = { hta::TimePoint(hta::Duration(time)), value };
+                return state;
+            }
+        }
+    }
+
+private:
+    std::atomic<State> state_{ State::unknown };
+    std::atomic<std::uint64_t> seq_{ 0 };
+    std::atomic<std::int64_t> time_{ 0 };
+    std::atomic<double> value_{ 0 };
+};
+
+/**
+ * Pool of read-only views of a metric that are used for reads outside of the metric's strand.
+ * Each view is used by one reader at a time. A view only sees what was flushed before it was
+ * opened, so views are replaced once newer data has been flushed.
+ */
+class ReadViews
+{
+public:
+    struct View
+    {
+        std::unique_ptr<hta::Directory> directory;
+        // flushed_until of the metric when the view was opened
+        hta::TimePoint flushed_until;
+    };
+
+    /**
+     * Views that were opened before until was flushed are closed.
+     * @return a view from the pool that contains everything flushed until the given time, an
+     *         empty view if there is none and a new view must be opened
+     */
+    View acquire(hta::TimePoint until)
+    {
+        // destroyed after the lock is released
+        std::vector<View> stale;
+        std::lock_guard<std::mutex> guard(lock_);
+        auto it = std::partition(views_.begin(), views_.end(),
+                                 [until](const View& view) { return view.flushed_until >= until; });
+        std::move(it, views_.end(), std::back_inserter(stale));
+        views_.erase(it, views_.end());
+        if (views_.empty())
+        {
+            return {};
+        }
+        auto view = std::move(views_.back());
+        views_.pop_back();
+        return view;
+    }
+
+    void release(View view)
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        views_.push_back(std::move(view));
+    }
+
+private:
+    std::mutex lock_;
+    std::vector<View> views_;
+};
+
+/**
+ * Everything needed to process requests of one metric. It is resolved once and then cached in
+ * the MetricEntry of the metric, so that requests don't need to look up anything by name.
+ */
+class MetricHandle
+{
+public:
+    using Strand = asio::strand<WorkerPool::executor_type>;
+
+    /**
+     * @param config configuration of the metric that must outlive the handle, nullptr for
+     *        metrics that are not configured
+     */
+    MetricHandle(std::string name, const WorkerPool::executor_type& executor,
+                 const metricq::json* config = nullptr)
+    : name_(std::move(name)), strand_(executor), config_(config)
+    {
+        touch();
+    }
+
+    MetricHandle(const MetricHandle&) = delete;
+
+    MetricHandle& operator=(const MetricHandle&) = delete;
+
+    const std::string& name() const
+    {
+        return name_;
+    }
+
+    Strand& strand()
+    {
+        return strand_;
+    }
+
+    const metricq::json* config() const
+    {
+        return config_;
+    }
+
+    WriteQueue& writes()
+    {
+        return writes_;
+    }
+
+    /**
+     * Metrics are opened on first use, the handle owns the directory that contains only this
+     * metric. Must be called on the strand.
+     */
+    void open(std::unique_ptr<hta::Directory> directory)
+    {
+        assert(!directory_);
+        metric_ = &(*directory)[name_];
+        directory_ = std::move(directory);
+        row_estimate_.levels(*metric_);
+        open_.store(true, std::memory_order_release);
+    }
+
+    /**
+     * Can be called from any thread
+     */
+    bool is_open() const
+    {
+        return open_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Can be called from any thread once is_open() returned true
+     */
+    const RowEstimate& row_estimate() const
+    {
+        return row_estimate_;
+    }
+
+    /**
+     * Must be called on the strand after open()
+     */
+    hta::Metric& metric()
+    {
+        assert(metric_);
+        return *metric_;
+    }
+
+    /**
+     * Timestamp of the newest value in the metric, must be called on the strand after open()
+     */
+    hta::TimePoint frontier()
+    {
+        if (!frontier_)
+        {
+            frontier_ = metric().range().second;
+        }
+        return *frontier_;
+    }
+
+    /**
+     * Must be called on the strand after values from first to time have been inserted
+     */
+    void advance(hta::TimePoint first, hta::TimePoint time, std::size_t values)
+    {
+        assert(frontier_ && time >= *frontier_);
+        frontier_ = time;
+        row_estimate_.inserted(values, first, time);
+        generation_.store(next_generation_(), std::memory_order_release);
+    }
+
+    /**
+     * Must be called on the strand after the metric was flushed
+     */
+    void flushed()
+    {
+        assert(frontier_);
+        flushed_until_.store(frontier_->time_since_epoch().count(), std::memory_order_release);
+    }
+
+    /**
+     * Newest timestamp that has been flushed to storage and is thus visible to read-only views,
+     * can be used from any thread
+     */
+    std::optional<hta::TimePoint> flushed_until() const
+    {
+        auto until = flushed_until_.load(std::memory_order_acquire);
+        if (until == unknown_time)
+        {
+            return std::nullopt;
+        }
+        return hta::TimePoint(hta::Duration(until));
+    }
+
+    ReadViews& views()
+    {
+        return views_;
+    }
+
+    /**
+     * Changes with every write pass that inserted values, can be used from any thread to detect
+     * whether the content of the metric changed. Generations are unique across all handles, so
+     * a handle that is created again for the same metric never repeats an earlier one.
+     */
+    std::uint64_t generation() const
+    {
+        return generation_.load(std::memory_order_acquire);
+    }
+
+    void touch()
+    {
+        last_used_.store(std::chrono::steady_clock::now().time_since_epoch().count(),
+                         std::memory_order_relaxed);
+    }
+
+    std::chrono::steady_clock::duration unused_for() const
+    {
+        return std::chrono::steady_clock::now().time_since_epoch() -
+               std::chrono::steady_clock::duration(last_used_.load(std::memory_order_relaxed));
+    }
+
+    struct Counters
+    {
+        std::atomic<std::uint64_t> write_chunks{ 0 };
+        std::atomic<std::uint64_t> write_values{ 0 };
+        std::atomic<std::uint64_t> write_bytes{ 0 };
+        std::atomic<std::int64_t> write_active_ns{ 0 };
+        std::atomic<std::uint64_t> skip_non_monotonic{ 0 };
+        std::atomic<std::uint64_t> skip_nan{ 0 };
+        std::atomic<std::uint64_t> skip_inf{ 0 };
+        std::atomic<std::uint64_t> read_requests{ 0 };
+        std::atomic<std::int64_t> read_active_ns{ 0 };
+
+        /**
+         * @return the activity since the last call
+         */
+        MetricActivity take()
+        {
+            MetricActivity activity;
+            activity.write_chunks = write_chunks.exchange(0, std::memory_order_relaxed);
+            activity.write_values = write_values.exchange(0, std::memory_order_relaxed);
+            activity.write_bytes = write_bytes.exchange(0, std::memory_order_relaxed);
+            activity.write_active =
+                metricq::Duration(write_active_ns.exchange(0, std::memory_order_relaxed));
+            activity.skip_non_monotonic =
+                skip_non_monotonic.exchange(0, std::memory_order_relaxed);
+            activity.skip_nan = skip_nan.exchange(0, std::memory_order_relaxed);
+            activity.skip_inf = skip_inf.exchange(0, std::memory_order_relaxed);
+            activity.read_requests = read_requests.exchange(0, std::memory_order_relaxed);
+            activity.read_active =
+                metricq::Duration(read_active_ns.exchange(0, std::memory_order_relaxed));
+            return activity;
+        }
+    };
+
+    Counters counters;
+
+    LastValue last_value;
+
+private:
+    std::string name_;
+    Strand strand_;
+    const metricq::json* config_;
+    RowEstimate row_estimate_;
+    WriteQueue writes_;
+
+    // only accessed on the strand
+    std::unique_ptr<hta::Directory> directory_;
+    hta::Metric* metric_ = nullptr;
+    std::atomic<bool> open_{ false };
+    std::optional<hta::TimePoint> frontier_;
+    std::atomic<std::uint64_t> generation_{ next_generation_() };
+
+    static std::uint64_t next_generation_()
+    {
+        static std::atomic<std::uint64_t> next{ 0 };
+        return next.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static constexpr auto unknown_time = std::numeric_limits<std::int64_t>::min();
+    std::atomic<std::int64_t> flushed_until_{ unknown_time };
+    ReadViews views_;
+
+    std::atomic<std::chrono::steady_clock::rep> last_used_{ 0 };
+};
+
+/**
+ * Per logical metric slot for the cached MetricHandle. Entries are never removed, but handles
+ * that haven't been used for a while are released, which also closes their metric.
+ */
+struct MetricEntry
+{
+    /**
+     * @return the cached handle, creates it if necessary
+     */
+    std::shared_ptr<MetricHandle> acquire(const WorkerPool::executor_type& executor)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!handle)
+        {
+            handle = std::make_shared<MetricHandle>(*name, executor, &config);
+        }
+        else
+        {
+            handle->touch();
+        }
+        return handle;
+    }
+
+    /**
+     * @return the cached handle if it has unflushed values, nullptr otherwise
+     */
+    std::shared_ptr<MetricHandle> dirty()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (handle && handle->writes().dirty())
+        {
+            return handle;
+        }
+        return nullptr;
+    }
+
+    /**
+     * @return the cached handle, nullptr if there is none, without marking it as used
+     */
+    std::shared_ptr<MetricHandle> cached()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return handle;
+    }
+
+    /**
+     * @return for how long the handle hasn't been used if it has an open metric
+     */
+    std::optional<std::chrono::steady_clock::duration> open_unused_for()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!handle || !handle->is_open())
+        {
+            return std::nullopt;
+        }
+        return handle->unused_for();
+    }
+
+    /**
+     * Release the handle if nobody else holds it, nothing is left to flush and it hasn't been
+     * used for the given duration
+     * @return true if the handle was released
+     */
+    bool evict(std::chrono::steady_clock::duration unused_for)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        // all copies are made under the lock, so nobody can get a new one in the meantime
+        if (!handle || handle.use_count() > 1 || handle->writes().dirty() ||
+            handle->unused_for() < unused_for)
+        {
+            return false;
+        }
+        handle.reset();
+        return true;
+    }
+
+    // points to the key of the entry
+    const std::string* name = nullptr;
+    // configuration of the metric, not modified after the entry is published
+    metricq::json config;
+    std::mutex lock;
+    std::shared_ptr<MetricHandle> handle;
+};
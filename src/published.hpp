@@ -0,0 +1,93 @@
+// metricq-db-hta
+// Copyright (C) 2021 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-db-hta.
+//
+// metricq-db-hta is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-db-hta is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-db-hta.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+/**
+ * Holds an immutable snapshot that is replaced as a whole, e.g. on reconfiguration.
+ *
+ * std::atomic_load on a shared_ptr is not lock-free with libstdc++, it takes a mutex from a
+ * global pool and modifies the shared reference count. Instead, get() keeps a copy of the
+ * shared_ptr per thread and only takes the lock after the snapshot was replaced, so the common
+ * case is a single atomic load of the version.
+ */
+template <typename T>
+class Published
+{
+public:
+    explicit Published(std::shared_ptr<const T> value)
+    {
+        store(std::move(value));
+    }
+
+    Published(const Published&) = delete;
+
+    Published& operator=(const Published&) = delete;
+
+    void store(std::shared_ptr<const T> value)
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        value_ = std::move(value);
+        // unique across all instances, so a per-thread copy never matches another instance
+        version_.store(next_version_.fetch_add(1, std::memory_order_relaxed),
+                       std::memory_order_release);
+    }
+
+    /**
+     * @return shared ownership of the current snapshot, takes the lock
+     */
+    std::shared_ptr<const T> load() const
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        return value_;
+    }
+
+    /**
+     * @return the current snapshot, the reference stays valid until the next call of get() on
+     *         a Published<T> on the same thread
+     */
+    const T& get() const
+    {
+        thread_local struct
+        {
+            std::uint64_t version = 0;
+            std::shared_ptr<const T> value;
+        } cache;
+        if (cache.version != version_.load(std::memory_order_acquire))
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            cache.value = value_;
+            cache.version = version_.load(std::memory_order_relaxed);
+        }
+        return *cache.value;
+    }
+
+private:
+    static inline std::atomic<std::uint64_t> next_version_{ 1 };
+
+    mutable std::mutex lock_;
+    std::shared_ptr<const T> value_;
+    std::atomic<std::uint64_t> version_{ 0 };
+};
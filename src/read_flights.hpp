@@ -0,0 +1,174 @@
+// metricq-db-hta
+// Copyright (C) 2021 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-db-hta.
+//
+// metricq-db-hta is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-db-hta is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-db-hta.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include "db_stats.hpp"
+#include "response_cache.hpp"
+
+#include <metricq/history.pb.h>
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Single-flight coalescing of identical history requests. While a request is queued or running,
+ * equivalent requests don't start another retrieval but wait for its response instead.
+ * Unlike the ResponseCache, nothing is kept once the request is finished.
+ * Coalesced requests are reported to DbStats.
+ */
+class ReadFlights
+{
+public:
+    using Key = ResponseCache::Key;
+
+    /**
+     * A request waiting for the response of an equivalent one
+     */
+    class Waiter
+    {
+    public:
+        virtual ~Waiter() = default;
+
+        virtual void respond(metricq::HistoryResponse& response) = 0;
+
+        virtual void failed(const std::string& id, const std::string& error) = 0;
+    };
+
+    explicit ReadFlights(DbStats& stats) : stats_(stats)
+    {
+    }
+
+    /**
+     * @param make_waiter creates the Waiter of the request, only called if it is attached
+     * @return true if an equivalent request is in flight and the waiter has been attached to
+     *         it, otherwise the caller leads the request and must call finish() with the key
+     */
+    template <typename MakeWaiter>
+    bool join(const Key& key, MakeWaiter make_waiter)
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        auto [it, inserted] = flights_.try_emplace(key);
+        if (inserted)
+        {
+            return false;
+        }
+        it->second.emplace_back(make_waiter());
+        stats_.read_coalesced();
+        return true;
+    }
+
+    /**
+     * End the flight of the request with the given key
+     * @return the waiters that must receive the response of the request
+     */
+    std::vector<std::unique_ptr<Waiter>> finish(const Key& key)
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        auto it = flights_.find(key);
+        if (it == flights_.end())
+        {
+            return {};
+        }
+        auto waiters = std::move(it->second);
+        flights_.erase(it);
+        return waiters;
+    }
+
+private:
+    DbStats& stats_;
+    std::mutex lock_;
+    std::unordered_map<Key, std::vector<std::unique_ptr<Waiter>>, ResponseCache::KeyHash>
+        flights_;
+};
+
+/**
+ * Wraps the handler of the request that leads a flight and passes its result on to the
+ * waiters. If the request is dropped without a result, the waiters fail.
+ * Handlers must not modify the response, it is shared by all of them.
+ */
+template <class Handler>
+class FlightLeader
+{
+public:
+    FlightLeader(ReadFlights& flights, ReadFlights::Key key, Handler handler)
+    : flights_(&flights), key_(std::move(key)), handler_(std::move(handler))
+    {
+    }
+
+    FlightLeader(FlightLeader&& other)
+    : flights_(other.flights_), key_(std::exchange(other.key_, std::nullopt)),
+      handler_(std::move(other.handler_))
+    {
+    }
+
+    FlightLeader& operator=(FlightLeader&&) = delete;
+
+    ~FlightLeader()
+    {
+        if (key_)
+        {
+            for (auto& waiter : flights_->finish(*key_))
+            {
+                waiter->failed(key_->metric, "equivalent request was not processed");
+            }
+        }
+    }
+
+    void operator()(metricq::HistoryResponse& response)
+    {
+        auto waiters = finish();
+        handler_(response);
+        for (auto& waiter : waiters)
+        {
+            waiter->respond(response);
+        }
+    }
+
+    void failed(const std::string& id, const std::string& error)
+    {
+        auto waiters = finish();
+        handler_.failed(id, error);
+        for (auto& waiter : waiters)
+        {
+            waiter->failed(id, error);
+        }
+    }
+
+private:
+    std::vector<std::unique_ptr<ReadFlights::Waiter>> finish()
+    {
+        if (!key_)
+        {
+            return {};
+        }
+        auto waiters = flights_->finish(*key_);
+        key_.reset();
+        return waiters;
+    }
+
+    ReadFlights* flights_;
+    std::optional<ReadFlights::Key> key_;
+    Handler handler_;
+};
@@ -0,0 +1,289 @@
+// metricq-db-hta
+// Copyright (C) 2021 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-db-hta.
+//
+// metricq-db-hta is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-db-hta is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-db-hta.  If not, see <http://www.gnu.org/licenses/>.
+#include "async_hta_service.hpp"
+#include "capture.hpp"
+#include "log.hpp"
+
+#include <metricq/chrono.hpp>
+#include <metricq/datachunk.pb.h>
+#include <metricq/history.pb.h>
+#include <metricq/json.hpp>
+
+#include <nitro/options/parser.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Latencies and throughput of the replayed requests per request type
+ */
+class ReplayStats
+{
+public:
+    void issued()
+    {
+        issued_++;
+    }
+
+    void completed(const std::string& type, metricq::Duration latency, std::size_t values,
+                   bool failed)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            auto& stats = types_[type];
+            stats.latencies.push_back(latency);
+            stats.values += values;
+            stats.failed += failed;
+        }
+        completed_++;
+    }
+
+    void wait()
+    {
+        while (completed_.load() < issued_.load())
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+    void report(metricq::Duration elapsed)
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        auto seconds = std::chrono::duration_cast<std::chrono::duration<double>>(elapsed).count();
+        std::cout << "replayed " << completed_.load() << " requests in " << seconds << " s\n";
+        std::cout << std::left << std::setw(20) << "type" << std::right << std::setw(10)
+                  << "count" << std::setw(8) << "failed" << std::setw(12) << "req/s"
+                  << std::setw(14) << "values/s" << std::setw(10) << "p50 ms" << std::setw(10)
+                  << "p90 ms" << std::setw(10) << "p99 ms" << std::setw(10) << "max ms"
+                  << "\n";
+        for (auto& [type, stats] : types_)
+        {
+            auto& latencies = stats.latencies;
+            std::sort(latencies.begin(), latencies.end());
+            auto percentile = [&latencies](double p) {
+                auto index = static_cast<std::size_t>(p * (latencies.size() - 1));
+                return std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(
+                           latencies[index])
+                    .count();
+            };
+            std::cout << std::left << std::setw(20) << type << std::right << std::setw(10)
+                      << latencies.size() << std::setw(8) << stats.failed << std::setw(12)
+                      << std::fixed << std::setprecision(1) << latencies.size() / seconds
+                      << std::setw(14) << stats.values / seconds << std::setprecision(3)
+                      << std::setw(10) << percentile(0.5) << std::setw(10) << percentile(0.9)
+                      << std::setw(10) << percentile(0.99) << std::setw(10) << percentile(1.0)
+                      << "\n";
+        }
+    }
+
+private:
+    struct TypeStats
+    {
+        std::vector<metricq::Duration> latencies;
+        std::size_t values = 0;
+        std::size_t failed = 0;
+    };
+
+    std::atomic<std::uint64_t> issued_{ 0 };
+    std::atomic<std::uint64_t> completed_{ 0 };
+    std::mutex lock_;
+    std::map<std::string, TypeStats> types_;
+};
+
+struct WriteHandler
+{
+    void operator()()
+    {
+        stats->completed("write", metricq::Clock::now() - start, values, false);
+    }
+
+    ReplayStats* stats;
+    metricq::TimePoint start;
+    std::size_t values;
+};
+
+struct ReadHandler
+{
+    void operator()(metricq::HistoryResponse& response)
+    {
+        stats->completed(type, metricq::Clock::now() - start,
+                         response.aggregate_size() + response.value_size(), false);
+    }
+
+    void failed(const std::string& id, const std::string& error)
+    {
+        Log::warn() << "history request for " << id << " failed: " << error;
+        stats->completed(type, metricq::Clock::now() - start, 0, true);
+    }
+
+    ReplayStats* stats;
+    metricq::TimePoint start;
+    std::string type;
+};
+
+int main(int argc, char* argv[])
+{
+    metricq::logger::nitro::set_severity(nitro::log::severity_level::info);
+
+    nitro::options::parser parser;
+    parser.option("capture", "The capture file recorded with metricq-db-hta --capture.")
+        .short_name("c");
+    parser.option("path", "The HTA directory to replay into instead of the captured one.")
+        .default_value("")
+        .short_name("p");
+    parser.option("speed", "Replay speed relative to the recording, or 'max' for no delays.")
+        .default_value("1");
+    parser.toggle("verbose").short_name("v");
+    parser.toggle("quiet").short_name("q");
+    parser.toggle("help").short_name("h");
+
+    try
+    {
+        auto options = parser.parse(argc, argv);
+
+        if (options.given("help"))
+        {
+            parser.usage();
+            return 0;
+        }
+
+        if (options.given("verbose"))
+        {
+            metricq::logger::nitro::set_severity(nitro::log::severity_level::debug);
+        }
+        else if (options.given("quiet"))
+        {
+            metricq::logger::nitro::set_severity(nitro::log::severity_level::warn);
+        }
+        metricq::logger::nitro::initialize();
+
+        // 0 means as fast as possible
+        double speed = 0;
+        if (options.get("speed") != "max")
+        {
+            speed = std::stod(options.get("speed"));
+            if (speed <= 0)
+            {
+                throw std::runtime_error("invalid replay speed");
+            }
+        }
+
+        CaptureReader reader(options.get("capture"));
+        auto service = std::make_unique<AsyncHtaService>();
+        ReplayStats stats;
+        bool configured = false;
+        std::optional<metricq::TimePoint> capture_begin;
+        auto replay_begin = metricq::Clock::now();
+
+        CaptureRecord record;
+        metricq::DataChunk chunk;
+        metricq::HistoryRequest request;
+        while (reader.next(record))
+        {
+            if (record.kind == CaptureKind::config)
+            {
+                auto config = metricq::json::parse(record.payload);
+                if (!options.get("path").empty())
+                {
+                    config["path"] = options.get("path");
+                }
+                std::promise<void> done;
+                service->async_config(config, [&done](const metricq::json&) { done.set_value(); });
+                done.get_future().get();
+                configured = true;
+                continue;
+            }
+            if (!configured)
+            {
+                throw std::runtime_error("capture contains requests before the first config");
+            }
+
+            if (!capture_begin)
+            {
+                capture_begin = record.time;
+                replay_begin = metricq::Clock::now();
+            }
+            else if (speed > 0)
+            {
+                auto offset = std::chrono::duration_cast<metricq::Duration>(
+                    (record.time - *capture_begin) / speed);
+                std::this_thread::sleep_until(replay_begin + offset);
+            }
+
+            stats.issued();
+            if (record.kind == CaptureKind::data)
+            {
+                if (!chunk.ParseFromString(record.payload))
+                {
+                    throw std::runtime_error("invalid data chunk in capture");
+                }
+                service->async_write(
+                    record.name, chunk,
+                    WriteHandler{ &stats, metricq::Clock::now(),
+                                  static_cast<std::size_t>(chunk.value_size()) });
+            }
+            else if (record.kind == CaptureKind::history)
+            {
+                if (!request.ParseFromString(record.payload))
+                {
+                    throw std::runtime_error("invalid history request in capture");
+                }
+                service->async_read(
+                    record.name, request,
+                    ReadHandler{ &stats, metricq::Clock::now(),
+                                 metricq::HistoryRequest::RequestType_Name(request.type()) });
+            }
+            else
+            {
+                throw std::runtime_error("unknown record in capture");
+            }
+        }
+
+        stats.wait();
+        auto elapsed = metricq::Clock::now() - replay_begin;
+        // flushes everything that is left
+        service.reset();
+        stats.report(elapsed);
+    }
+    catch (nitro::options::parsing_error& e)
+    {
+        std::cerr << e.what() << "\n";
+        parser.usage();
+        return 1;
+    }
+    catch (std::exception& e)
+    {
+        Log::error() << "Unhandled exception: " << e.what();
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,99 @@
+// metricq-db-hta
+// Copyright (C) 2021 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-db-hta.
+//
+// metricq-db-hta is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-db-hta is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-db-hta.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <metricq/history.pb.h>
+
+#include <google/protobuf/arena.h>
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+
+/**
+ * HistoryResponse that is allocated in a per-thread arena, so that the messages of a response
+ * with many aggregates are not allocated one by one. The arena is reset when the response is
+ * destroyed and keeps its initial block, so there must only be one response per thread at a time.
+ */
+class ArenaResponse
+{
+public:
+    ArenaResponse() : arena_(thread_arena())
+    {
+        assert(!arena_.in_use);
+        arena_.in_use = true;
+        response_ =
+            google::protobuf::Arena::CreateMessage<metricq::HistoryResponse>(&arena_.arena);
+    }
+
+    ArenaResponse(const ArenaResponse&) = delete;
+
+    ArenaResponse& operator=(const ArenaResponse&) = delete;
+
+    ~ArenaResponse()
+    {
+        arena_.arena.Reset();
+        arena_.in_use = false;
+    }
+
+    metricq::HistoryResponse& operator*()
+    {
+        return *response_;
+    }
+
+    metricq::HistoryResponse* operator->()
+    {
+        return response_;
+    }
+
+private:
+    struct ThreadArena
+    {
+        static constexpr std::size_t initial_block_size = 64 * 1024;
+        static constexpr std::size_t max_block_size = 1024 * 1024;
+
+        ThreadArena()
+        : initial_block(new char[initial_block_size]), arena(options(initial_block.get()))
+        {
+        }
+
+        static google::protobuf::ArenaOptions options(char* block)
+        {
+            google::protobuf::ArenaOptions options;
+            options.initial_block = block;
+            options.initial_block_size = initial_block_size;
+            options.max_block_size = max_block_size;
+            return options;
+        }
+
+        std::unique_ptr<char[]> initial_block;
+        google::protobuf::Arena arena;
+        bool in_use = false;
+    };
+
+    static ThreadArena& thread_arena()
+    {
+        thread_local ThreadArena arena;
+        return arena;
+    }
+
+    ThreadArena& arena_;
+    metricq::HistoryResponse* response_;
+};
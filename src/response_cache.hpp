@@ -0,0 +1,194 @@
+// metricq-db-hta
+// Copyright (C) 2021 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-db-hta.
+//
+// metricq-db-hta is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-db-hta is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-db-hta.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include "db_stats.hpp"
+
+#include <metricq/history.pb.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * Bounded LRU cache of finished history responses.
+ * Hits, misses and evictions are reported to DbStats.
+ *
+ * Metrics are append-only, so a response only becomes outdated if it covers time after the
+ * newest value of the metric at the time it was computed. Such open responses are stored with
+ * the write generation of the metric and are dropped as soon as anything was written since.
+ */
+class ResponseCache
+{
+public:
+    struct Key
+    {
+        std::string metric;
+        int type;
+        std::int64_t start_time;
+        std::int64_t end_time;
+        std::int64_t interval_max;
+
+        bool operator==(const Key& other) const
+        {
+            return metric == other.metric && type == other.type &&
+                   start_time == other.start_time && end_time == other.end_time &&
+                   interval_max == other.interval_max;
+        }
+    };
+
+    struct KeyHash
+    {
+        std::size_t operator()(const Key& key) const
+        {
+            auto hash = std::hash<std::string>()(key.metric);
+            for (auto value : { static_cast<std::int64_t>(key.type), key.start_time,
+                                key.end_time, key.interval_max })
+            {
+                hash ^= std::hash<std::int64_t>()(value) + 0x9e3779b97f4a7c15 + (hash << 6) +
+                        (hash >> 2);
+            }
+            return hash;
+        }
+    };
+
+    explicit ResponseCache(DbStats& stats) : stats_(stats)
+    {
+    }
+
+    void resize(std::size_t max_size)
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        max_size_ = max_size;
+        stats_.cache_evict(shrink(max_size_));
+        stats_.cache_size(size_);
+    }
+
+    bool enabled() const
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        return max_size_ > 0;
+    }
+
+    /**
+     * @param generation the current write generation of the metric
+     * @return the cached response, or nullptr if there is none or it is outdated
+     */
+    std::shared_ptr<const metricq::HistoryResponse> get(const Key& key, std::uint64_t generation)
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        auto it = index_.find(key);
+        if (it == index_.end())
+        {
+            stats_.cache_miss();
+            return nullptr;
+        }
+        auto entry = it->second;
+        if (!entry->closed && entry->generation != generation)
+        {
+            size_ -= entry->size;
+            index_.erase(it);
+            entries_.erase(entry);
+            stats_.cache_miss();
+            stats_.cache_evict(1);
+            stats_.cache_size(size_);
+            return nullptr;
+        }
+        // mark as most recently used
+        entries_.splice(entries_.begin(), entries_, entry);
+        stats_.cache_hit();
+        return entry->response;
+    }
+
+    /**
+     * @param generation the write generation of the metric the response was computed at
+     * @param closed true if the response cannot be changed by future writes to the metric
+     */
+    void put(const Key& key, const metricq::HistoryResponse& response, std::uint64_t generation,
+             bool closed)
+    {
+        auto size = response.ByteSizeLong() + key.metric.size() + sizeof(Entry);
+        std::lock_guard<std::mutex> guard(lock_);
+        if (size > max_size_ / 4)
+        {
+            // don't let a single huge response flush the entire cache
+            return;
+        }
+        if (auto it = index_.find(key); it != index_.end())
+        {
+            size_ -= it->second->size;
+            entries_.erase(it->second);
+            index_.erase(it);
+        }
+        stats_.cache_evict(shrink(max_size_ - size));
+        entries_.push_front(
+            { key, std::make_shared<const metricq::HistoryResponse>(response), size, generation,
+              closed });
+        index_.emplace(key, entries_.begin());
+        size_ += size;
+        stats_.cache_size(size_);
+    }
+
+    std::size_t size() const
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        return size_;
+    }
+
+private:
+    struct Entry
+    {
+        Key key;
+        std::shared_ptr<const metricq::HistoryResponse> response;
+        std::size_t size;
+        std::uint64_t generation;
+        bool closed;
+    };
+
+    /**
+     * Evict least recently used entries until at most target_size bytes are used
+     * @return the number of evicted entries
+     */
+    std::size_t shrink(std::size_t target_size)
+    {
+        std::size_t evicted = 0;
+        while (size_ > target_size && !entries_.empty())
+        {
+            size_ -= entries_.back().size;
+            index_.erase(entries_.back().key);
+            entries_.pop_back();
+            evicted++;
+        }
+        return evicted;
+    }
+
+    DbStats& stats_;
+    mutable std::mutex lock_;
+    std::size_t max_size_ = 0;
+    std::size_t size_ = 0;
+    // most recently used first
+    std::list<Entry> entries_;
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index_;
+};
@@ -0,0 +1,154 @@
+// metricq-db-hta
+// Copyright (C) 2021 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-db-hta.
+//
+// metricq-db-hta is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-db-hta is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-db-hta.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <hta/hta.hpp>
+
+#include <metricq/history.pb.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Cheap estimate of the number of rows a timeline request produces, based on the aggregate
+ * levels of the metric and its observed rate of raw values. No data is read for an estimate.
+ */
+class RowEstimate
+{
+public:
+    /**
+     * Take the levels and the stored values of a metric that has just been opened. Must happen
+     * before the estimate is published to other threads.
+     */
+    void levels(hta::Metric& metric)
+    {
+        interval_min_ = metric.interval_min().count();
+        interval_max_ = metric.interval_max().count();
+        interval_factor_ = metric.interval_factor();
+        count_ = metric.count();
+        if (count_ > 0)
+        {
+            auto [first, last] = metric.range();
+            first_ = first;
+            update_rate_(last);
+        }
+    }
+
+    /**
+     * Account values appended by a write pass, without touching the storage. Must be called
+     * on the strand of the metric.
+     */
+    void inserted(std::uint64_t values, hta::TimePoint first, hta::TimePoint last)
+    {
+        if (count_ == 0)
+        {
+            first_ = first;
+        }
+        count_ += values;
+        update_rate_(last);
+    }
+
+    bool known() const
+    {
+        return interval_min_ > 0 && interval_factor_ > 1;
+    }
+
+    /**
+     * @return the estimated number of rows or raw values, 0 for requests other than timelines
+     */
+    std::int64_t rows(const metricq::HistoryRequest& request) const
+    {
+        auto span = request.end_time() - request.start_time();
+        if (!known() || span <= 0)
+        {
+            return 0;
+        }
+        switch (request.type())
+        {
+        case metricq::HistoryRequest::FLEX_TIMELINE:
+            if (request.interval_max() < interval_min_)
+            {
+                // raw values
+                return static_cast<std::int64_t>(
+                    std::min(span * rate_.load(std::memory_order_relaxed), 1e18));
+            }
+            [[fallthrough]];
+        case metricq::HistoryRequest::AGGREGATE_TIMELINE:
+            return span / level_interval(request.interval_max()) + 1;
+        default:
+            return 0;
+        }
+    }
+
+    /**
+     * @return the interval of the finest aggregate level that produces at most max_rows for the
+     *         request, 0 if even the coarsest level produces more
+     */
+    std::int64_t fitting_interval(const metricq::HistoryRequest& request,
+                                  std::int64_t max_rows) const
+    {
+        auto span = request.end_time() - request.start_time();
+        for (auto interval = interval_min_;; interval *= interval_factor_)
+        {
+            if (span / interval + 1 <= max_rows)
+            {
+                return interval;
+            }
+            if (interval > interval_max_ / interval_factor_)
+            {
+                return 0;
+            }
+        }
+    }
+
+private:
+    void update_rate_(hta::TimePoint last)
+    {
+        if (count_ > 1 && last > first_)
+        {
+            rate_.store(static_cast<double>(count_ - 1) / (last - first_).count(),
+                        std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @return the interval of the coarsest level that is not coarser than interval_max
+     */
+    std::int64_t level_interval(std::int64_t interval_max) const
+    {
+        auto interval = interval_min_;
+        while (interval <= interval_max_ / interval_factor_ &&
+               interval * interval_factor_ <= interval_max)
+        {
+            interval *= interval_factor_;
+        }
+        return interval;
+    }
+
+    std::int64_t interval_min_ = 0;
+    std::int64_t interval_max_ = 0;
+    std::int64_t interval_factor_ = 0;
+    // only accessed on the strand of the metric
+    std::uint64_t count_ = 0;
+    hta::TimePoint first_;
+    // raw values per ns
+    std::atomic<double> rate_{ 0 };
+};
@@ -0,0 +1,367 @@
+// metricq-db-hta
+// Copyright (C) 2021 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-db-hta.
+//
+// metricq-db-hta is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-db-hta is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-db-hta.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include "db_stats.hpp"
+#include "task.hpp"
+#include "work_class.hpp"
+
+#include <metricq/chrono.hpp>
+#include <metricq/history.pb.h>
+#include <metricq/json.hpp>
+
+#include <asio.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <utility>
+
+struct SchedulerConfig
+{
+    SchedulerConfig() = default;
+
+    SchedulerConfig(const metricq::json& config)
+    {
+        if (!config.count("scheduler"))
+        {
+            return;
+        }
+        const auto& scheduler = config.at("scheduler");
+        if (scheduler.count("weights"))
+        {
+            const auto& weights_config = scheduler.at("weights");
+            for (auto work_class :
+                 { WorkClass::interactive_read, WorkClass::bulk_read, WorkClass::write })
+            {
+                auto& weight = weights[index(work_class)];
+                weight = weights_config.value(name(work_class), weight);
+                if (weight == 0)
+                {
+                    throw std::runtime_error(
+                        std::string("configuration error, invalid scheduler weight for ") +
+                        name(work_class));
+                }
+            }
+        }
+        if (scheduler.count("deadlines"))
+        {
+            const auto& deadlines_config = scheduler.at("deadlines");
+            // writes have no deadline, acknowledged data must not be dropped
+            for (auto work_class : { WorkClass::interactive_read, WorkClass::bulk_read })
+            {
+                if (!deadlines_config.count(name(work_class)))
+                {
+                    continue;
+                }
+                auto deadline =
+                    std::chrono::milliseconds(deadlines_config.at(name(work_class)).get<int>());
+                if (deadline.count() <= 0)
+                {
+                    throw std::runtime_error(
+                        std::string("configuration error, invalid scheduler deadline for ") +
+                        name(work_class));
+                }
+                deadlines[index(work_class)] = deadline;
+            }
+        }
+        reserved_read_threads = scheduler.value("reserved_read_threads", reserved_read_threads);
+        bulk_rows = scheduler.value("bulk_rows", bulk_rows);
+        if (reserved_read_threads < 0 || bulk_rows <= 0)
+        {
+            throw std::runtime_error(
+                "configuration error, invalid scheduler reserved_read_threads or bulk_rows");
+        }
+    }
+
+    // relative share of the worker threads while several classes have queued work
+    std::array<unsigned, work_class_count> weights = { 8, 1, 4 };
+    // maximum time a request may wait before it is started, measured from its arrival
+    std::array<std::optional<std::chrono::milliseconds>, work_class_count> deadlines;
+    // number of worker threads that are never occupied by writes
+    int reserved_read_threads = 0;
+    // history requests that may produce more rows are considered bulk reads
+    std::int64_t bulk_rows = 100000;
+};
+
+/**
+ * Admission of work to the worker pool with separate queues per WorkClass.
+ * Work is only handed to its executor when a worker is free, so that a backlog of one class
+ * can't delay another class by more than the work already running. Free workers are assigned
+ * by stride scheduling according to the configured weights.
+ * At most one item per executor is handed over at a time, as a strand runs only one of them
+ * and further items would occupy workers without running.
+ */
+class Scheduler
+{
+public:
+    explicit Scheduler(DbStats& stats) : stats_(stats)
+    {
+    }
+
+    Scheduler(const Scheduler&) = delete;
+
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    /**
+     * @param threads number of workers of the pool the work is executed on
+     */
+    void configure(const SchedulerConfig& config, int threads)
+    {
+        if (config.reserved_read_threads >= threads)
+        {
+            throw std::runtime_error("configuration error, at least one thread must be left for "
+                                     "writes after reserved_read_threads");
+        }
+        std::lock_guard<std::mutex> guard(lock_);
+        config_ = config;
+        threads_ = threads;
+        dispatch();
+    }
+
+    /**
+     * Change the number of workers, work that is already running beyond the new number is
+     * not interrupted
+     */
+    void resize(int threads)
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        assert(config_.reserved_read_threads < threads);
+        threads_ = threads;
+        dispatch();
+    }
+
+    struct Load
+    {
+        // average number of busy workers
+        double busy;
+        // number of queued items at the time of the call
+        std::size_t queued;
+    };
+
+    /**
+     * @return the load since the previous call
+     */
+    Load take_load()
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        account_busy();
+        auto now = metricq::Clock::now();
+        Load load{ 0, 0 };
+        if (now > load_since_)
+        {
+            load.busy = static_cast<double>(busy_time_.count()) / (now - load_since_).count();
+        }
+        for (const auto& queue : queues_)
+        {
+            load.queued += queue.size();
+        }
+        busy_time_ = metricq::Duration(0);
+        load_since_ = now;
+        return load;
+    }
+
+    WorkClass classify(const metricq::HistoryRequest& request) const
+    {
+        std::int64_t rows = 1;
+        if (request.type() == metricq::HistoryRequest::AGGREGATE_TIMELINE ||
+            request.type() == metricq::HistoryRequest::FLEX_TIMELINE)
+        {
+            auto duration = request.end_time() - request.start_time();
+            rows = request.interval_max() > 0 ? duration / request.interval_max() :
+                                                std::numeric_limits<std::int64_t>::max();
+        }
+        std::lock_guard<std::mutex> guard(lock_);
+        return rows > config_.bulk_rows ? WorkClass::bulk_read : WorkClass::interactive_read;
+    }
+
+    /**
+     * @return true if work that arrived at pending_since should no longer be started
+     */
+    bool expired(WorkClass work_class, metricq::TimePoint pending_since) const
+    {
+        std::optional<std::chrono::milliseconds> deadline;
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            deadline = config_.deadlines[index(work_class)];
+        }
+        if (!deadline || metricq::Clock::now() - pending_since <= *deadline)
+        {
+            return false;
+        }
+        stats_.queue_expired(work_class);
+        return true;
+    }
+
+    /**
+     * Queue function to be run on executor once a worker is assigned to work_class
+     * @param executor identified by its address, must outlive the queued work
+     */
+    template <typename Executor, typename Function>
+    void post(WorkClass work_class, const Executor& executor, Function function)
+    {
+        const void* key = &executor;
+        Task task([this, work_class, key, executor, function = std::move(function)]() mutable {
+            asio::post(executor,
+                       [this, work_class, key, function = std::move(function)]() mutable {
+                           Finished finished{ *this, work_class, key };
+                           function();
+                       });
+        });
+        std::lock_guard<std::mutex> guard(lock_);
+        auto& queue = queues_[index(work_class)];
+        if (queue.empty())
+        {
+            // don't let an idle class catch up on the time it didn't use
+            pass_[index(work_class)] = std::max(pass_[index(work_class)], virtual_time_);
+        }
+        queue.push_back({ metricq::Clock::now(), key, std::move(task) });
+        stats_.queue_push(work_class);
+        dispatch();
+    }
+
+private:
+    struct Item
+    {
+        metricq::TimePoint queued_since;
+        const void* executor;
+        Task task;
+    };
+
+    struct Finished
+    {
+        ~Finished()
+        {
+            std::lock_guard<std::mutex> guard(scheduler.lock_);
+            assert(scheduler.running_[index(work_class)] > 0);
+            scheduler.account_busy();
+            scheduler.running_[index(work_class)]--;
+            scheduler.running_total_--;
+            scheduler.busy_executors_.erase(executor);
+            scheduler.dispatch();
+        }
+
+        Scheduler& scheduler;
+        WorkClass work_class;
+        const void* executor;
+    };
+
+    /**
+     * @return the first item of the queue whose executor has no work handed over, must hold lock_
+     */
+    std::optional<std::size_t> ready(std::size_t queue_index) const
+    {
+        const auto& queue = queues_[queue_index];
+        for (std::size_t i = 0; i < queue.size(); i++)
+        {
+            if (!busy_executors_.count(queue[i].executor))
+            {
+                return i;
+            }
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * Assign free workers to queued work, must hold lock_
+     */
+    void dispatch()
+    {
+        while (running_total_ < threads_)
+        {
+            std::optional<WorkClass> next;
+            std::size_t position = 0;
+            for (auto work_class :
+                 { WorkClass::interactive_read, WorkClass::bulk_read, WorkClass::write })
+            {
+                auto i = index(work_class);
+                if (work_class == WorkClass::write &&
+                    running_[i] >= threads_ - config_.reserved_read_threads)
+                {
+                    continue;
+                }
+                if (next && pass_[i] >= pass_[index(*next)])
+                {
+                    continue;
+                }
+                if (auto ready_position = ready(i))
+                {
+                    next = work_class;
+                    position = *ready_position;
+                }
+            }
+            if (!next)
+            {
+                return;
+            }
+            auto i = index(*next);
+            auto item = std::move(queues_[i][position]);
+            queues_[i].erase(queues_[i].begin() + position);
+            busy_executors_.insert(item.executor);
+            virtual_time_ = pass_[i];
+            pass_[i] += stride_unit / config_.weights[i];
+            account_busy();
+            running_[i]++;
+            running_total_++;
+            stats_.queue_pop(*next, metricq::Clock::now() - item.queued_since);
+            // only posts to the executor, so it is fine to call this while holding the lock
+            item.task();
+        }
+    }
+
+    /**
+     * Add the time workers were busy since the last change, must hold lock_ and be called before
+     * running_total_ changes
+     */
+    void account_busy()
+    {
+        auto now = metricq::Clock::now();
+        busy_time_ += (now - busy_since_) * running_total_;
+        busy_since_ = now;
+    }
+
+    static constexpr std::uint64_t stride_unit = 1 << 20;
+
+    DbStats& stats_;
+    mutable std::mutex lock_;
+    SchedulerConfig config_;
+    int threads_ = 0;
+    int running_total_ = 0;
+    std::array<int, work_class_count> running_{};
+    std::array<std::deque<Item>, work_class_count> queues_;
+    // executors that have an item handed over which hasn't finished yet
+    std::unordered_set<const void*> busy_executors_;
+    std::array<std::uint64_t, work_class_count> pass_{};
+    std::uint64_t virtual_time_ = 0;
+    // integral of the number of busy workers over time
+    metricq::Duration busy_time_ = metricq::Duration(0);
+    metricq::TimePoint busy_since_ = metricq::Clock::now();
+    metricq::TimePoint load_since_ = metricq::Clock::now();
+};
@@ -0,0 +1,93 @@
+// metricq-db-hta
+// Copyright (C) 2021 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-db-hta.
+//
+// metricq-db-hta is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-db-hta is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-db-hta.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+ * Set of counters that are updated concurrently from many threads. Each thread updates one of
+ * several shards, each on its own cache line, with relaxed atomics, so that threads don't
+ * contend on a lock or a shared cache line. Reading a counter sums up all shards.
+ *
+ * Counters that are incremented and decremented, e.g. the number of requests in a state, can
+ * be changed on different shards; only the sum is meaningful.
+ */
+template <std::size_t Count>
+class ShardedCounters
+{
+public:
+    static constexpr std::size_t shard_count = 16;
+
+    ShardedCounters() : shards_(new Shard[shard_count])
+    {
+    }
+
+    void add(std::size_t counter, std::int64_t value)
+    {
+        shards_[shard()].counters[counter].fetch_add(value, std::memory_order_relaxed);
+    }
+
+    std::int64_t load(std::size_t counter) const
+    {
+        std::int64_t sum = 0;
+        for (std::size_t i = 0; i < shard_count; i++)
+        {
+            sum += shards_[i].counters[counter].load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+    /**
+     * Read the counter and reset it to zero. Concurrent updates are counted either in this or
+     * in the next call.
+     */
+    std::int64_t exchange(std::size_t counter)
+    {
+        std::int64_t sum = 0;
+        for (std::size_t i = 0; i < shard_count; i++)
+        {
+            sum += shards_[i].counters[counter].exchange(0, std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+private:
+    struct alignas(64) Shard
+    {
+        std::array<std::atomic<std::int64_t>, Count> counters{};
+    };
+
+    /**
+     * Threads are assigned to shards round-robin on their first update
+     */
+    static std::size_t shard()
+    {
+        static std::atomic<std::size_t> next_shard{ 0 };
+        thread_local std::size_t shard =
+            next_shard.fetch_add(1, std::memory_order_relaxed) % shard_count;
+        return shard;
+    }
+
+    std::unique_ptr<Shard[]> shards_;
+};
@@ -0,0 +1,149 @@
+// metricq-db-hta
+// Copyright (C) 2021 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-db-hta.
+//
+// metricq-db-hta is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-db-hta is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-db-hta.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/**
+ * Type-erased, move-only void() callable, e.g. the completion handler of a queued write.
+ * Small callables are stored inline to avoid an allocation per use.
+ */
+class Task
+{
+public:
+    Task() = default;
+
+    template <typename Handler,
+              typename = std::enable_if_t<!std::is_same_v<std::decay_t<Handler>, Task>>>
+    Task(Handler handler)
+    {
+        if constexpr (sizeof(Impl<Handler>) <= sizeof(storage_) &&
+                      alignof(Impl<Handler>) <= alignof(std::max_align_t) &&
+                      std::is_nothrow_move_constructible_v<Handler>)
+        {
+            impl_ = new (&storage_) Impl<Handler>(std::move(handler));
+            local_ = true;
+        }
+        else
+        {
+            impl_ = new Impl<Handler>(std::move(handler));
+        }
+    }
+
+    Task(Task&& other) noexcept
+    {
+        take(other);
+    }
+
+    Task& operator=(Task&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            take(other);
+        }
+        return *this;
+    }
+
+    ~Task()
+    {
+        reset();
+    }
+
+    void operator()()
+    {
+        assert(impl_);
+        (*impl_)();
+    }
+
+private:
+    struct Base
+    {
+        virtual ~Base() = default;
+        virtual void operator()() = 0;
+        virtual Base* move_to(void* storage) noexcept = 0;
+    };
+
+    template <typename Handler>
+    struct Impl : Base
+    {
+        Impl(Handler handler) : handler(std::move(handler))
+        {
+        }
+
+        void operator()() override
+        {
+            handler();
+        }
+
+        Base* move_to(void* storage) noexcept override
+        {
+            if constexpr (std::is_nothrow_move_constructible_v<Handler>)
+            {
+                return new (storage) Impl(std::move(handler));
+            }
+            else
+            {
+                // never stored inline
+                assert(false);
+                return nullptr;
+            }
+        }
+
+        Handler handler;
+    };
+
+    void take(Task& other) noexcept
+    {
+        if (other.local_)
+        {
+            impl_ = other.impl_->move_to(&storage_);
+            local_ = true;
+            other.reset();
+        }
+        else
+        {
+            impl_ = other.impl_;
+            other.impl_ = nullptr;
+        }
+    }
+
+    void reset() noexcept
+    {
+        if (local_)
+        {
+            impl_->~Base();
+        }
+        else
+        {
+            delete impl_;
+        }
+        impl_ = nullptr;
+        local_ = false;
+    }
+
+    alignas(std::max_align_t) unsigned char storage_[64];
+    Base* impl_ = nullptr;
+    bool local_ = false;
+};
@@ -0,0 +1,56 @@
+// metricq-db-hta
+// Copyright (C) 2021 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-db-hta.
+//
+// metricq-db-hta is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-db-hta is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-db-hta.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <cstddef>
+
+/**
+ * Classes of work that are queued separately by the Scheduler
+ */
+enum class WorkClass
+{
+    // small history requests that somebody is probably waiting for
+    interactive_read,
+    // large history requests, e.g. exports
+    bulk_read,
+    // draining the write queue of a metric
+    write,
+};
+
+constexpr std::size_t work_class_count = 3;
+
+constexpr std::size_t index(WorkClass work_class)
+{
+    return static_cast<std::size_t>(work_class);
+}
+
+constexpr const char* name(WorkClass work_class)
+{
+    switch (work_class)
+    {
+    case WorkClass::interactive_read:
+        return "interactive";
+    case WorkClass::bulk_read:
+        return "bulk";
+    case WorkClass::write:
+        return "write";
+    }
+    return "unknown";
+}
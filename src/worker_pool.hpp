@@ -0,0 +1,172 @@
+// metricq-db-hta
+// Copyright (C) 2021 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-db-hta.
+//
+// metricq-db-hta is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-db-hta is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-db-hta.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include <asio.hpp>
+
+#include <atomic>
+#include <cassert>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/**
+ * Pool of worker threads running an io_context, similar to asio::thread_pool, but the number
+ * of workers can be changed at any time.
+ *
+ * Retired workers finish the handler they are running and then exit. Queued work, including
+ * work of strands, is not bound to a specific worker and is taken over by the remaining ones.
+ */
+class WorkerPool
+{
+public:
+    using executor_type = asio::io_context::executor_type;
+
+    explicit WorkerPool(int threads) : work_(asio::make_work_guard(io_context_))
+    {
+        resize(threads);
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    ~WorkerPool()
+    {
+        join();
+    }
+
+    executor_type get_executor()
+    {
+        return io_context_.get_executor();
+    }
+
+    /**
+     * @return the number of workers that are not retired
+     */
+    int size() const
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        return size_;
+    }
+
+    void resize(int threads)
+    {
+        assert(threads > 0);
+        std::lock_guard<std::mutex> guard(lock_);
+        if (joining_)
+        {
+            return;
+        }
+        reap_();
+        for (; size_ < threads; size_++)
+        {
+            auto& worker = workers_.emplace_back(std::make_unique<Worker>());
+            worker->thread = std::thread([this, &worker = *worker]() { run_(worker); });
+        }
+        for (; size_ > threads; size_--)
+        {
+            retire_++;
+            // wake up an idle worker to notice the retirement
+            asio::post(io_context_, []() {});
+        }
+    }
+
+    /**
+     * Wait until all work is done and stop the workers. Later calls to resize() are ignored.
+     */
+    void join()
+    {
+        std::list<std::unique_ptr<Worker>> workers;
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            joining_ = true;
+            work_.reset();
+            workers = std::move(workers_);
+            workers_.clear();
+            size_ = 0;
+        }
+        // without the lock, remaining work may still call size() or resize()
+        for (auto& worker : workers)
+        {
+            if (worker->thread.joinable())
+            {
+                worker->thread.join();
+            }
+        }
+    }
+
+private:
+    struct Worker
+    {
+        std::thread thread;
+        std::atomic<bool> exited{ false };
+    };
+
+    void run_(Worker& worker)
+    {
+        // run_one() only returns 0 once the io_context is out of work after join()
+        while (!take_retirement_() && io_context_.run_one() > 0)
+        {
+        }
+        worker.exited = true;
+    }
+
+    bool take_retirement_()
+    {
+        auto retire = retire_.load();
+        while (retire > 0)
+        {
+            if (retire_.compare_exchange_weak(retire, retire - 1))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Join the threads of retired workers that have exited, must hold lock_
+     */
+    void reap_()
+    {
+        for (auto it = workers_.begin(); it != workers_.end();)
+        {
+            if ((*it)->exited)
+            {
+                (*it)->thread.join();
+                it = workers_.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    asio::io_context io_context_;
+    asio::executor_work_guard<asio::io_context::executor_type> work_;
+    mutable std::mutex lock_;
+    std::list<std::unique_ptr<Worker>> workers_;
+    int size_ = 0;
+    bool joining_ = false;
+    std::atomic<int> retire_{ 0 };
+};
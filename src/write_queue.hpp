@@ -0,0 +1,198 @@
+// metricq-db-hta
+// Copyright (C) 2021 ZIH, Technische Universitaet Dresden, Federal Republic of Germany
+//
+// All rights reserved.
+//
+// This file is part of metricq-db-hta.
+//
+// metricq-db-hta is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// metricq-db-hta is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with metricq-db-hta.  If not, see <http://www.gnu.org/licenses/>.
+#pragma once
+
+#include "chunk_buffer.hpp"
+#include "task.hpp"
+
+#include <metricq/chrono.hpp>
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+using WriteCompletion = Task;
+
+struct PendingWrite
+{
+    ChunkBufferPool::Handle chunk;
+    metricq::TimePoint pending_since;
+    WriteCompletion completion;
+};
+
+/**
+ * Per-metric queue of chunks that have been received but not yet written.
+ * At most one drain of the queue is scheduled on the metric's strand at any time,
+ * the drain takes all chunks that accumulated in the meantime in one go.
+ */
+class WriteQueue
+{
+public:
+    /**
+     * @return true if the queue was idle and the caller must schedule a drain
+     */
+    bool push(PendingWrite write)
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        pending_.emplace_back(std::move(write));
+        if (scheduled_)
+        {
+            return false;
+        }
+        scheduled_ = true;
+        return true;
+    }
+
+    /**
+     * Take all pending writes, must only be called from the scheduled drain.
+     * The returned writes stay valid until the next call of take().
+     */
+    std::vector<PendingWrite>& take()
+    {
+        // release the chunks of the previous drain, but keep the capacity
+        draining_.clear();
+        std::lock_guard<std::mutex> guard(lock_);
+        assert(scheduled_);
+        draining_.swap(pending_);
+        return draining_;
+    }
+
+    /**
+     * Called at the end of a drain
+     * @return true if more writes arrived meanwhile and another drain must be scheduled
+     */
+    bool finish()
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        assert(scheduled_);
+        if (pending_.empty())
+        {
+            scheduled_ = false;
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @return the number of chunks waiting for the next drain
+     */
+    std::size_t backlog()
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        return pending_.size();
+    }
+
+    /**
+     * Keep the completion of a finished write until release_held(), must be called on the
+     * metric's strand
+     */
+    void hold(WriteCompletion completion)
+    {
+        held_.emplace_back(std::move(completion));
+    }
+
+    /**
+     * Must be called on the metric's strand
+     * @return the completions held back so far
+     */
+    std::vector<WriteCompletion> release_held()
+    {
+        return std::exchange(held_, {});
+    }
+
+    /**
+     * @return true if writes are queued or being processed
+     */
+    bool busy()
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        return scheduled_;
+    }
+
+    /**
+     * @return true if no writes are waiting, i.e. the current drain is the last one for now
+     */
+    bool idle()
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        return pending_.empty();
+    }
+
+    /**
+     * Record that values were inserted into the metric, but not yet flushed.
+     * Must be called on the metric's strand.
+     */
+    void inserted(std::uint64_t count)
+    {
+        unflushed_values_ += count;
+        if (count > 0)
+        {
+            dirty_ = true;
+        }
+    }
+
+    /**
+     * Must be called on the metric's strand after the metric was flushed.
+     */
+    void flushed()
+    {
+        unflushed_values_ = 0;
+        last_flush_ = std::chrono::steady_clock::now();
+        dirty_ = false;
+    }
+
+    /**
+     * Can be called from any thread, e.g. to find metrics for a background flush
+     */
+    bool dirty() const
+    {
+        return dirty_;
+    }
+
+    std::uint64_t unflushed_values() const
+    {
+        return unflushed_values_;
+    }
+
+    std::chrono::steady_clock::duration since_flush() const
+    {
+        return std::chrono::steady_clock::now() - last_flush_;
+    }
+
+private:
+    std::mutex lock_;
+    std::vector<PendingWrite> pending_;
+    bool scheduled_ = false;
+
+    // only accessed on the metric's strand
+    std::vector<PendingWrite> draining_;
+    std::vector<WriteCompletion> held_;
+
+    // flush state, only modified on the metric's strand
+    std::atomic<bool> dirty_{ false };
+    std::uint64_t unflushed_values_ = 0;
+    std::chrono::steady_clock::time_point last_flush_ = std::chrono::steady_clock::now();
+};